@@ -0,0 +1,49 @@
+//==============================================================================
+// Copyright (c) 2007-2009, Isaac Marino Bavaresco
+// All rights reserved
+// isaacbavaresco@yahoo.com.br
+//==============================================================================
+#include "addontrace.h"
+//==============================================================================
+#if			defined ADDONS_TRACE
+//==============================================================================
+#if			( addontraceRING_SIZE & ( addontraceRING_SIZE - 1 )) != 0 || addontraceRING_SIZE > 65535
+#error "addontraceRING_SIZE must be a power of two smaller than 65536"
+#endif
+//==============================================================================
+xAddonTraceRing	xAddonTraceRings[ addontraceNUM_CORES ];
+//==============================================================================
+void vAddonTraceInit( void )
+	{
+	unsigned int	i;
+
+	for( i = 0; i < addontraceNUM_CORES; i++ )
+		{
+		xAddonTraceRings[ i ].usCore		= i;
+		xAddonTraceRings[ i ].usSize		= addontraceRING_SIZE;
+		xAddonTraceRings[ i ].ulTimestampHz	= addontraceTIMESTAMP_HZ;
+		xAddonTraceRings[ i ].ulHead		= 0;
+		__atomic_store_n( &xAddonTraceRings[ i ].ulMagic, addontraceMAGIC, __ATOMIC_RELEASE );
+		}
+	}
+//==============================================================================
+void vAddonTraceRecord( uint32_t ulEvent, const void *pvObject, const void *pvTask, uint32_t ulArg )
+	{
+	xAddonTraceRing		*pxRing;
+	xAddonTraceRecord	*pxRecord;
+
+	pxRing		= &xAddonTraceRings[ addontraceCORE_ID() ];
+	if( pxRing->ulMagic != addontraceMAGIC )
+		return;
+
+	// An ISR that interrupts us just takes the next slot.
+	pxRecord	= &pxRing->xRecords[ __atomic_fetch_add( &pxRing->ulHead, 1, __ATOMIC_RELAXED ) & ( addontraceRING_SIZE - 1 ) ];
+
+	pxRecord->ulTimestamp	= addontraceTIMESTAMP();
+	pxRecord->ulObject		= (uint32_t)(uintptr_t)pvObject;
+	pxRecord->ulTask		= (uint32_t)(uintptr_t)pvTask;
+	pxRecord->ulEventArg	= ( ulEvent << 24 ) | ( ulArg & 0x00ffffff );
+	}
+//==============================================================================
+#endif	//	defined ADDONS_TRACE
+//==============================================================================
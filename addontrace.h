@@ -0,0 +1,108 @@
+//==============================================================================
+// Copyright (c) 2007-2009, Isaac Marino Bavaresco
+// All rights reserved
+// isaacbavaresco@yahoo.com.br
+//==============================================================================
+// Compile-time trace hooks for the FlexiQueue and the mutex.
+//
+// When ADDONS_TRACE is defined, every hook stores a 16-byte record into the
+// ring of the core it runs on (xAddonTraceRings). The rings can be dumped from
+// a debugger or by the application and decoded on the host with
+// addontrace_decode.c. When ADDONS_TRACE is not defined the hooks expand to
+// nothing.
+//
+// A ring is written only by the core it belongs to, tasks and ISRs alike, and
+// a slot is claimed with a single atomic increment, so no lock is needed.
+//==============================================================================
+#ifndef		__ADDONTRACE_H__
+#define		__ADDONTRACE_H__
+//==============================================================================
+#include <stdint.h>
+//==============================================================================
+// Event codes, also understood by addontrace_decode.c. Do not renumber.
+//==============================================================================
+#define	addontraceFQ_ENQUEUE		0x01	// Arg = item size
+#define	addontraceFQ_DEQUEUE		0x02	// Arg = item size
+#define	addontraceFQ_BLOCK_READ		0x03	// Arg = ticks to wait
+#define	addontraceFQ_BLOCK_WRITE	0x04	// Arg = ticks to wait
+#define	addontraceFQ_TIMEOUT_READ	0x05
+#define	addontraceFQ_TIMEOUT_WRITE	0x06
+#define	addontraceFQ_WAKE_READER	0x07
+#define	addontraceFQ_WAKE_WRITER	0x08
+#define	addontraceFQ_HANDOFF_READ	0x09	// Task = new reading owner
+#define	addontraceFQ_HANDOFF_WRITE	0x0a	// Task = new writing owner
+#define	addontraceFQ_FLUSH			0x0b	// Arg = flag
+
+#define	addontraceMUTEX_TAKE		0x20	// Arg = nesting count
+#define	addontraceMUTEX_GIVE		0x21	// Arg = nesting count left
+#define	addontraceMUTEX_CONTEND		0x22	// Arg = ticks to wait
+#define	addontraceMUTEX_TIMEOUT		0x23
+#define	addontraceMUTEX_HANDOFF		0x24	// Task = new owner
+#define	addontraceMUTEX_SPIN		0x25	// Arg = mutexSPIN_CLOCK ticks spun, bit 23 set if the mutex was taken
+
+#define	addontraceMAGIC				0x41545243u		// "ATRC"
+//==============================================================================
+#if			defined ADDONS_TRACE
+//==============================================================================
+#include "FreeRTOS.h"
+#include "task.h"
+//==============================================================================
+// Number of records per core, must be a power of two.
+#if			!defined addontraceRING_SIZE
+#define	addontraceRING_SIZE			256
+#endif	//	!defined addontraceRING_SIZE
+
+// Free-running 32-bit time source and its frequency (for the decoder).
+#if			!defined addontraceTIMESTAMP
+#define	addontraceTIMESTAMP()		( (uint32_t)xTaskGetTickCountFromISR() )
+#define	addontraceTIMESTAMP_HZ		configTICK_RATE_HZ
+#elif		!defined addontraceTIMESTAMP_HZ
+#error "addontraceTIMESTAMP is defined, addontraceTIMESTAMP_HZ must be defined too"
+#endif	//	!defined addontraceTIMESTAMP
+
+#if			defined configNUMBER_OF_CORES && configNUMBER_OF_CORES > 1
+#define	addontraceNUM_CORES			configNUMBER_OF_CORES
+#define	addontraceCORE_ID()			portGET_CORE_ID()
+#else
+#define	addontraceNUM_CORES			1
+#define	addontraceCORE_ID()			0
+#endif
+//==============================================================================
+typedef struct
+{
+	uint32_t		ulTimestamp;
+	uint32_t		ulObject;
+	uint32_t		ulTask;
+	uint32_t		ulEventArg;		// Event in the top byte, argument in the other 24 bits
+} xAddonTraceRecord;
+
+typedef struct
+{
+	uint32_t			ulMagic;
+	uint16_t			usCore;
+	uint16_t			usSize;
+	uint32_t			ulTimestampHz;
+	volatile uint32_t	ulHead;		// Total records ever written, the ring holds the last usSize
+	xAddonTraceRecord	xRecords[ addontraceRING_SIZE ];
+} xAddonTraceRing;
+//==============================================================================
+extern xAddonTraceRing	xAddonTraceRings[ addontraceNUM_CORES ];
+
+void vAddonTraceInit( void );
+void vAddonTraceRecord( uint32_t ulEvent, const void *pvObject, const void *pvTask, uint32_t ulArg );
+//==============================================================================
+#define	traceADDON( Event, Object, Arg )			vAddonTraceRecord( ( Event ), ( Object ), xTaskGetCurrentTaskHandle(), (uint32_t)( Arg ) )
+#define	traceADDON_TASK( Event, Object, Task, Arg )	vAddonTraceRecord( ( Event ), ( Object ), ( Task ), (uint32_t)( Arg ) )
+// An ISR runs on behalf of no task, don't charge its events to the interrupted one.
+#define	traceADDON_ISR( Event, Object, Arg )		vAddonTraceRecord( ( Event ), ( Object ), NULL, (uint32_t)( Arg ) )
+//==============================================================================
+#else	//	defined ADDONS_TRACE
+//==============================================================================
+#define	traceADDON( Event, Object, Arg )
+#define	traceADDON_TASK( Event, Object, Task, Arg )
+#define	traceADDON_ISR( Event, Object, Arg )
+//==============================================================================
+#endif	//	defined ADDONS_TRACE
+//==============================================================================
+#endif	//	__ADDONTRACE_H__
+//==============================================================================
@@ -0,0 +1,377 @@
+//==============================================================================
+// Copyright (c) 2007-2009, Isaac Marino Bavaresco
+// All rights reserved
+// isaacbavaresco@yahoo.com.br
+//==============================================================================
+// Host-side decoder for the trace rings written by addontrace.c.
+//
+// Build: cc -o addontrace_decode addontrace_decode.c
+// Usage: addontrace_decode [-s] dump.bin
+//
+// dump.bin is a raw image of xAddonTraceRings (one or more rings back to back),
+// as saved for instance with GDB's "dump binary value dump.bin
+// xAddonTraceRings". The records of all cores are merged into a single
+// timeline, followed by a latency report per object. -s prints only the
+// report.
+//==============================================================================
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+//==============================================================================
+#include "addontrace.h"
+//==============================================================================
+#define	RING_HEADER_SIZE	16
+#define	RECORD_SIZE			16
+//==============================================================================
+typedef struct
+	{
+	int64_t			Time;		// Unwrapped timestamp
+	uint32_t		Object;
+	uint32_t		Task;
+	uint32_t		Arg;
+	unsigned int	Event;
+	unsigned int	Core;
+	unsigned long	Sequence;	// Position in the ring, keeps sort stable
+	} event_t;
+//==============================================================================
+typedef struct
+	{
+	uint32_t		Object;
+	unsigned int	Kind;
+	unsigned long	Count;
+	uint64_t		Min, Max, Total;
+	} stat_t;
+//==============================================================================
+enum
+	{
+	STAT_READ_WAIT,
+	STAT_WRITE_WAIT,
+	STAT_WAKE_TO_RUN,
+	STAT_MUTEX_WAIT,
+	STAT_MUTEX_HOLD,
+	STAT_KINDS
+	};
+
+static const char *StatNames[ STAT_KINDS ] =
+	{
+	"queue read wait",
+	"queue write wait",
+	"wake to run",
+	"mutex wait",
+	"mutex hold"
+	};
+//==============================================================================
+static event_t		*Events;
+static size_t		NumEvents;
+static stat_t		*Stats;
+static size_t		NumStats;
+static uint32_t		TimestampHz;
+static int64_t		Reference;	// Unwrapped time of the first ring's newest record
+static int			HaveReference;
+//==============================================================================
+static const char *EventName( unsigned int Event )
+	{
+	switch( Event )
+		{
+		case addontraceFQ_ENQUEUE:			return "FQ_ENQUEUE";
+		case addontraceFQ_DEQUEUE:			return "FQ_DEQUEUE";
+		case addontraceFQ_BLOCK_READ:		return "FQ_BLOCK_READ";
+		case addontraceFQ_BLOCK_WRITE:		return "FQ_BLOCK_WRITE";
+		case addontraceFQ_TIMEOUT_READ:		return "FQ_TIMEOUT_READ";
+		case addontraceFQ_TIMEOUT_WRITE:	return "FQ_TIMEOUT_WRITE";
+		case addontraceFQ_WAKE_READER:		return "FQ_WAKE_READER";
+		case addontraceFQ_WAKE_WRITER:		return "FQ_WAKE_WRITER";
+		case addontraceFQ_HANDOFF_READ:		return "FQ_HANDOFF_READ";
+		case addontraceFQ_HANDOFF_WRITE:	return "FQ_HANDOFF_WRITE";
+		case addontraceFQ_FLUSH:			return "FQ_FLUSH";
+		case addontraceMUTEX_TAKE:			return "MUTEX_TAKE";
+		case addontraceMUTEX_GIVE:			return "MUTEX_GIVE";
+		case addontraceMUTEX_CONTEND:		return "MUTEX_CONTEND";
+		case addontraceMUTEX_TIMEOUT:		return "MUTEX_TIMEOUT";
+		case addontraceMUTEX_HANDOFF:		return "MUTEX_HANDOFF";
+		case addontraceMUTEX_SPIN:			return "MUTEX_SPIN";
+		default:							return "?";
+		}
+	}
+//==============================================================================
+static uint32_t Get32( const unsigned char *p, int Swap )
+	{
+	return Swap ? (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3]
+				: (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+	}
+//==============================================================================
+static unsigned int Get16( const unsigned char *p, int Swap )
+	{
+	return Swap ? (unsigned int)p[0] << 8 | p[1] : (unsigned int)p[1] << 8 | p[0];
+	}
+//==============================================================================
+// Appends the valid records of one ring, oldest first. Returns the ring's size
+// in bytes, or 0 if there is no ring at Image.
+//
+// The 32-bit timestamps are unwrapped walking back from the newest record, each
+// taken as the nearest time to the one after it. vAddonTraceRecord takes the
+// slot first and reads the timestamp after, so an ISR that interrupts a task
+// between the two records in the next slot a timestamp slightly earlier than
+// the task's, and only a backward jump of more than half the counter's range
+// is a wrap. The rings were dumped together, so the newest
+// record of every ring is placed within half the range of the first ring's,
+// giving all cores the same unwrapped timeline.
+//==============================================================================
+static size_t LoadRing( const unsigned char *Image, size_t Length )
+	{
+	unsigned int	Core, Size, First, i;
+	uint32_t		Head, Last = 0;
+	int64_t			Time = 0;
+	int				Swap;
+
+	if( Length < RING_HEADER_SIZE )
+		return 0;
+
+	if( Get32( Image, 0 ) == addontraceMAGIC )
+		Swap	= 0;
+	else if( Get32( Image, 1 ) == addontraceMAGIC )
+		Swap	= 1;
+	else
+		return 0;
+
+	Core		= Get16( Image + 4, Swap );
+	Size		= Get16( Image + 6, Swap );
+	TimestampHz	= Get32( Image + 8, Swap );
+	Head		= Get32( Image + 12, Swap );
+
+	if( Size == 0 || RING_HEADER_SIZE + (size_t)Size * RECORD_SIZE > Length )
+		return 0;
+
+	Events	= realloc( Events, ( NumEvents + Size ) * sizeof( event_t ));
+	if( Events == NULL )
+		{
+		perror( "realloc" );
+		exit( 1 );
+		}
+
+	First	= Head > Size ? Head - Size : 0;
+	for( i = Head; i-- > First; )
+		{
+		const unsigned char	*r = Image + RING_HEADER_SIZE + (size_t)( i % Size ) * RECORD_SIZE;
+		event_t				*e = &Events[ NumEvents + ( i - First ) ];
+		uint32_t			Timestamp;
+
+		Timestamp	= Get32( r, Swap );
+		if( i != Head - 1 )
+			Time   += (int32_t)( Timestamp - Last );
+		else
+			{
+			if( !HaveReference )
+				{
+				Reference		= Timestamp;
+				HaveReference	= 1;
+				}
+			Time	= Reference + (int32_t)( Timestamp - (uint32_t)Reference );
+			}
+		Last		= Timestamp;
+
+		e->Time		= Time;
+		e->Object	= Get32( r + 4, Swap );
+		e->Task		= Get32( r + 8, Swap );
+		e->Event	= Get32( r + 12, Swap ) >> 24;
+		e->Arg		= Get32( r + 12, Swap ) & 0x00ffffff;
+		e->Core		= Core;
+		e->Sequence	= i;
+		}
+	NumEvents  += Head - First;
+
+	return RING_HEADER_SIZE + (size_t)Size * RECORD_SIZE;
+	}
+//==============================================================================
+static int CompareEvents( const void *a, const void *b )
+	{
+	const event_t	*x = a, *y = b;
+
+	if( x->Time != y->Time )
+		return x->Time < y->Time ? -1 : 1;
+	if( x->Core != y->Core )
+		return x->Core < y->Core ? -1 : 1;
+	return x->Sequence < y->Sequence ? -1 : x->Sequence > y->Sequence;
+	}
+//==============================================================================
+static void AddSample( uint32_t Object, unsigned int Kind, uint64_t Value )
+	{
+	size_t	i;
+
+	for( i = 0; i < NumStats; i++ )
+		if( Stats[ i ].Object == Object && Stats[ i ].Kind == Kind )
+			break;
+
+	if( i == NumStats )
+		{
+		Stats	= realloc( Stats, ( NumStats + 1 ) * sizeof( stat_t ));
+		if( Stats == NULL )
+			{
+			perror( "realloc" );
+			exit( 1 );
+			}
+		memset( &Stats[ i ], 0, sizeof( stat_t ));
+		Stats[ i ].Object	= Object;
+		Stats[ i ].Kind		= Kind;
+		Stats[ i ].Min		= UINT64_MAX;
+		NumStats++;
+		}
+
+	Stats[ i ].Count++;
+	Stats[ i ].Total   += Value;
+	if( Value < Stats[ i ].Min )
+		Stats[ i ].Min	= Value;
+	if( Value > Stats[ i ].Max )
+		Stats[ i ].Max	= Value;
+	}
+//==============================================================================
+// Finds the first event after Index by Task on Object whose code is one of
+// Ends (terminated by 0). Returns NULL if the trace ends before.
+//==============================================================================
+static const event_t *FindNext( size_t Index, uint32_t Task, uint32_t Object, const unsigned int *Ends )
+	{
+	const unsigned int	*p;
+	size_t				i;
+
+	for( i = Index + 1; i < NumEvents; i++ )
+		if( Events[ i ].Task == Task && Events[ i ].Object == Object )
+			for( p = Ends; *p != 0; p++ )
+				if( Events[ i ].Event == *p )
+					return &Events[ i ];
+
+	return NULL;
+	}
+//==============================================================================
+static void Analyze( void )
+	{
+	static const unsigned int	ReadEnds[]		= { addontraceFQ_DEQUEUE, addontraceFQ_TIMEOUT_READ, addontraceFQ_BLOCK_READ, 0 };
+	static const unsigned int	WriteEnds[]		= { addontraceFQ_ENQUEUE, addontraceFQ_TIMEOUT_WRITE, addontraceFQ_BLOCK_WRITE, 0 };
+	static const unsigned int	MutexWaitEnds[]	= { addontraceMUTEX_TAKE, addontraceMUTEX_TIMEOUT, 0 };
+	static const unsigned int	MutexHoldEnds[]	= { addontraceMUTEX_GIVE, 0 };
+	static const unsigned int	AnyQueueEnds[]	= { addontraceFQ_DEQUEUE, addontraceFQ_ENQUEUE, addontraceFQ_TIMEOUT_READ, addontraceFQ_TIMEOUT_WRITE, 0 };
+	const event_t				*e, *End;
+	size_t						i;
+
+	for( i = 0; i < NumEvents; i++ )
+		{
+		e	= &Events[ i ];
+		switch( e->Event )
+			{
+			case addontraceFQ_BLOCK_READ:
+				// A block followed by another block is a spurious wake, measure each leg.
+				if(( End = FindNext( i, e->Task, e->Object, ReadEnds )) != NULL )
+					AddSample( e->Object, STAT_READ_WAIT, End->Time - e->Time );
+				break;
+			case addontraceFQ_BLOCK_WRITE:
+				if(( End = FindNext( i, e->Task, e->Object, WriteEnds )) != NULL )
+					AddSample( e->Object, STAT_WRITE_WAIT, End->Time - e->Time );
+				break;
+			case addontraceFQ_HANDOFF_READ:
+			case addontraceFQ_HANDOFF_WRITE:
+				if(( End = FindNext( i, e->Task, e->Object, AnyQueueEnds )) != NULL )
+					AddSample( e->Object, STAT_WAKE_TO_RUN, End->Time - e->Time );
+				break;
+			case addontraceMUTEX_CONTEND:
+				if(( End = FindNext( i, e->Task, e->Object, MutexWaitEnds )) != NULL )
+					AddSample( e->Object, STAT_MUTEX_WAIT, End->Time - e->Time );
+				break;
+			case addontraceMUTEX_HANDOFF:
+				if(( End = FindNext( i, e->Task, e->Object, MutexWaitEnds )) != NULL )
+					AddSample( e->Object, STAT_WAKE_TO_RUN, End->Time - e->Time );
+				break;
+			case addontraceMUTEX_TAKE:
+				if( e->Arg != 1 )
+					break;
+				// Outermost take, the hold ends with the give that leaves no nesting.
+				for( End = FindNext( i, e->Task, e->Object, MutexHoldEnds ); End != NULL && End->Arg != 0; End = FindNext( End - Events, e->Task, e->Object, MutexHoldEnds ))
+					{}
+				if( End != NULL )
+					AddSample( e->Object, STAT_MUTEX_HOLD, End->Time - e->Time );
+				break;
+			}
+		}
+	}
+//==============================================================================
+static double ToMicroseconds( uint64_t Ticks )
+	{
+	return TimestampHz != 0 ? (double)Ticks * 1e6 / TimestampHz : (double)Ticks;
+	}
+//==============================================================================
+int main( int argc, char *argv[] )
+	{
+	unsigned char	*Image;
+	const char		*Unit;
+	size_t			Length, Offset, RingSize, i;
+	int				SummaryOnly = 0;
+	long			FileSize;
+	FILE			*f;
+
+	if( argc == 3 && strcmp( argv[1], "-s" ) == 0 )
+		{
+		SummaryOnly	= 1;
+		argv++;
+		argc--;
+		}
+	if( argc != 2 )
+		{
+		fprintf( stderr, "usage: %s [-s] dump.bin\n", argv[0] );
+		return 2;
+		}
+
+	if(( f = fopen( argv[1], "rb" )) == NULL || fseek( f, 0, SEEK_END ) != 0 || ( FileSize = ftell( f )) < 0 )
+		{
+		perror( argv[1] );
+		return 1;
+		}
+	rewind( f );
+	Length	= FileSize;
+	Image	= malloc( Length ? Length : 1 );
+	if( Image == NULL || fread( Image, 1, Length, f ) != Length )
+		{
+		perror( argv[1] );
+		return 1;
+		}
+	fclose( f );
+
+	// Rings may be padded by the compiler, so look for the next magic word.
+	for( Offset = 0; Offset + RING_HEADER_SIZE <= Length; )
+		{
+		if(( RingSize = LoadRing( Image + Offset, Length - Offset )) != 0 )
+			Offset += RingSize;
+		else
+			Offset += 4;
+		}
+	free( Image );
+
+	if( NumEvents == 0 )
+		{
+		fprintf( stderr, "%s: no trace records found\n", argv[1] );
+		return 1;
+		}
+
+	qsort( Events, NumEvents, sizeof( event_t ), CompareEvents );
+	Unit	= TimestampHz != 0 ? "us" : "ticks";
+
+	if( !SummaryOnly )
+		{
+		printf( "%14s %4s %10s %10s %-18s %s\n", Unit, "core", "task", "object", "event", "arg" );
+		for( i = 0; i < NumEvents; i++ )
+			printf( "%14.1f %4u 0x%08lx 0x%08lx %-18s %lu\n", ToMicroseconds( Events[ i ].Time - Events[ 0 ].Time ), Events[ i ].Core,
+					(unsigned long)Events[ i ].Task, (unsigned long)Events[ i ].Object, EventName( Events[ i ].Event ), (unsigned long)Events[ i ].Arg );
+		printf( "\n" );
+		}
+
+	Analyze();
+
+	printf( "%10s %-18s %8s %12s %12s %12s  (%s)\n", "object", "latency", "count", "min", "avg", "max", Unit );
+	for( i = 0; i < NumStats; i++ )
+		printf( "0x%08lx %-18s %8lu %12.1f %12.1f %12.1f\n", (unsigned long)Stats[ i ].Object, StatNames[ Stats[ i ].Kind ], Stats[ i ].Count,
+				ToMicroseconds( Stats[ i ].Min ), ToMicroseconds( Stats[ i ].Total ) / Stats[ i ].Count, ToMicroseconds( Stats[ i ].Max ));
+
+	free( Events );
+	free( Stats );
+
+	return 0;
+	}
+//==============================================================================
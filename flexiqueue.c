@@ -34,7 +34,10 @@ isaacbavaresco@yahoo.com.br
 #include "list.h"
 #include "task.h"
 /*============================================================================*/
-#include "FlexiQueue.h"
+#include "flexiqueue.h"
+#include "addontrace.h"
+/*============================================================================*/
+#if			!defined QUEUE_SMP
 /*============================================================================*/
 flexiqueue_t *xFlexiQueueCreate( unsigned int QueueLength, int Mode )
 	{
@@ -55,6 +58,11 @@ flexiqueue_t *xFlexiQueueCreate( unsigned int QueueLength, int Mode )
 #if			defined QUEUE_STRICT_CHRONOLOGY
 	Queue->ReadingOwner			= NULL;
 	Queue->WritingOwner			= NULL;
+#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
+	Queue->ItemsReserved		= 0;
+	Queue->BytesReserved		= 0;
+	Queue->Flushes				= 0;
+	Queue->WriteReserved		= 0;
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 	vListInitialise( &( Queue->TasksWaitingToWrite ) );
 	vListInitialise( &( Queue->TasksWaitingToRead ) );
@@ -96,10 +104,154 @@ static inline __attribute((always_inline)) unsigned int GetSizeOfNextItem( flexi
 	return ItemLength + 1;
 	}
 /*============================================================================*/
+#if			!defined QUEUE_STRICT_CHRONOLOGY
+/*============================================================================*/
+/*
+ A blocked task is woken only to be given what it is waiting for: the waker
+ reserves an item (ItemsReserved) or room for one (BytesReserved) on its behalf
+ and replaces the task's extra parameter, which held its buffer or item size,
+ with one of these markers. A task that finds the parameter unchanged after
+ waking up has timed out.
+
+ A grant carries the queue's flush count at the time it was made, so a reader
+ can tell whether a flush took its item before it got to run.
+*/
+/*============================================================================*/
+#define	WAIT_FLUSHED			((void*)~0ul)
+#define	WAIT_GRANT_FLAG			( ~0ul ^ ( ~0ul >> 1 ))
+#define	WAIT_GRANTED( Flushes )	((void*)( WAIT_GRANT_FLAG | ( (unsigned long)( Flushes ) & ( ~0ul >> 2 ))))
+
+/* Or'ed into the item size of a task waiting in xFlexiQueueReserve. */
+#define	WAIT_RESERVE			0x10000u
+/*============================================================================*/
+/*
+ Blocks the calling task until it is granted an item or room for one, the
+ queue is flushed or TimeToWait expires. The task is placed on the event list
+ only once, so it keeps its place in line for the whole wait, and TimeToWait is
+ handed to the kernel as is, so a tickless idle can sleep until it expires.
+ portMAX_DELAY waits forever; if the kernel can't block indefinitely
+ (INCLUDE_vTaskSuspend == 0) the wait is simply renewed when it expires.
+ Must be called inside a critical section.
+*/
+/*============================================================================*/
+static int WaitForGrant( flexiqueue_t *Queue, xList *List, unsigned int Size, portTickType TimeToWait )
+	{
+	xTaskHandle		Self	= xTaskGetCurrentTaskHandle();
+	void			*Result;
+
+	do
+		{
+		vSetExtraParameter( Self, (void*)Size );
+		traceADDON( List == &Queue->TasksWaitingToRead ? addontraceFQ_BLOCK_READ : addontraceFQ_BLOCK_WRITE, Queue, TimeToWait );
+		vTaskPlaceOnEventList( List, TimeToWait );
+
+		taskYIELD();
+
+		Result	= pvGetExtraParameter( Self );
+		}
+	while( Result == (void*)Size && TimeToWait == portMAX_DELAY );
+
+	if( Result == (void*)Size || Result == WAIT_FLUSHED )
+		return 0;
+
+	/* A flush after the grant took the reader's item; the room granted to a writer is still its own. */
+	return List == &Queue->TasksWaitingToWrite || Result == WAIT_GRANTED( Queue->Flushes );
+	}
+/*============================================================================*/
+/*
+ Hands the items nobody has claimed yet to the readers at the head of the list,
+ one each. FromISR tells whether we were called from an ISR. Returns non-zero
+ if a woken task has higher priority than ours.
+*/
+/*============================================================================*/
+static int GrantReaders( flexiqueue_t *Queue, int FromISR )
+	{
+	xTaskHandle		p;
+	int				Woken	= 0;
+
+	while( Queue->ItemsAvailable > Queue->ItemsReserved && !listLIST_IS_EMPTY( &Queue->TasksWaitingToRead ))
+		{
+		p	= (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToRead );
+		Queue->ItemsReserved++;
+		vSetExtraParameter( p, WAIT_GRANTED( Queue->Flushes ));
+		traceADDON_TASK( addontraceFQ_HANDOFF_READ, Queue, p, 0 );
+
+		if( FromISR )
+			{
+			traceADDON_ISR( addontraceFQ_WAKE_READER, Queue, 0 );
+			}
+		else
+			{
+			traceADDON( addontraceFQ_WAKE_READER, Queue, 0 );
+			}
+		if( xTaskRemoveFromEventList( &Queue->TasksWaitingToRead ) == pdTRUE )
+			Woken	= 1;
+		}
+
+	return Woken;
+	}
+/*============================================================================*/
+/*
+ Hands the free room to the writers at the head of the list, in order, for as
+ long as their items fit. A writer whose item doesn't fit keeps the ones behind
+ it waiting, otherwise a stream of small items could starve it. FromISR and the
+ result are as for GrantReaders.
+
+ A task waiting to reserve is given the write side too (WriteReserved), so it
+ waits for the writers granted before it to write, and nobody is granted
+ anything behind it until it commits or cancels.
+*/
+/*============================================================================*/
+static int GrantWriters( flexiqueue_t *Queue, int FromISR )
+	{
+	xTaskHandle		p;
+	unsigned int	Size;
+	int				Woken	= 0;
+
+	while( Queue->WriteReserved == 0 && !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
+		{
+		p		= (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToWrite );
+		Size	= (unsigned int)pvGetExtraParameter( p );
+		if( Size & WAIT_RESERVE )
+			{
+			Size	= EffectiveSize( Size & ~WAIT_RESERVE );
+			if( Queue->BytesReserved != 0 || Size > Queue->BytesFree )
+				break;
+			Queue->BytesFree	   -= Size;
+			Queue->WriteReserved	= Size;
+			}
+		else
+			{
+			Size	= EffectiveSize( Size );
+			if( Size > Queue->BytesFree - Queue->BytesReserved )
+				break;
+			Queue->BytesReserved   += Size;
+			}
+		vSetExtraParameter( p, WAIT_GRANTED( Queue->Flushes ));
+		traceADDON_TASK( addontraceFQ_HANDOFF_WRITE, Queue, p, 0 );
+
+		if( FromISR )
+			{
+			traceADDON_ISR( addontraceFQ_WAKE_WRITER, Queue, 0 );
+			}
+		else
+			{
+			traceADDON( addontraceFQ_WAKE_WRITER, Queue, 0 );
+			}
+		if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE )
+			Woken	= 1;
+		}
+
+	return Woken;
+	}
+/*============================================================================*/
+#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
+/*============================================================================*/
 int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, portTickType TimeToWait )
 	{
-	portTickType 		DeadLine;
+#if			defined QUEUE_STRICT_CHRONOLOGY
 	xTaskHandle			p;
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 	int					MustYield = 0;
 	unsigned int		RemoveIndex, ItemLength, Aux, RemainingBytes;
 
@@ -111,7 +263,8 @@ int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, po
 #if			defined QUEUE_STRICT_CHRONOLOGY
 	if( Queue->ItemsAvailable == 0 || Queue->ReadingOwner != NULL || !listLIST_IS_EMPTY( &Queue->TasksWaitingToRead ))
 #else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-	if( Queue->ItemsAvailable == 0 )
+	/* Items already granted to woken readers are not ours to take. */
+	if( Queue->ItemsAvailable <= Queue->ItemsReserved )
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 		{
 		if( TimeToWait == 0 )
@@ -120,30 +273,27 @@ int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, po
 			return 0;
 			}
 
-		DeadLine	= xTaskGetTickCount() + TimeToWait;
+#if			defined QUEUE_STRICT_CHRONOLOGY
 		vSetExtraParameter( xTaskGetCurrentTaskHandle(), (void*)BufferSize );
 
-#if			!defined QUEUE_STRICT_CHRONOLOGY
-		do
-#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
-			{
-			vTaskPlaceOnEventList( &( Queue->TasksWaitingToRead ), DeadLine );
+		traceADDON( addontraceFQ_BLOCK_READ, Queue, TimeToWait );
+		vTaskPlaceOnEventList( &( Queue->TasksWaitingToRead ), TimeToWait );
 
-	        taskYIELD();
-	        }
-#if			!defined QUEUE_STRICT_CHRONOLOGY
-		while(( (signed long)TimeToWait < 0 || (signed long)( DeadLine - xTaskGetTickCount() ) > 0 ) && Queue->ItemsAvailable == 0 );
-#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
+        taskYIELD();
 
-#if			defined QUEUE_STRICT_CHRONOLOGY
 		if( Queue->ItemsAvailable == 0 || Queue->ReadingOwner != xTaskGetCurrentTaskHandle() )
 #else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-		if( Queue->ItemsAvailable == 0 )
+		if( !WaitForGrant( Queue, &Queue->TasksWaitingToRead, min( BufferSize, Queue->QueueLength ), TimeToWait ))
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 			{
+			traceADDON( addontraceFQ_TIMEOUT_READ, Queue, 0 );
 			portEXIT_CRITICAL();
 			return 0;
 			}
+
+#if			!defined QUEUE_STRICT_CHRONOLOGY
+		Queue->ItemsReserved--;
+#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
 		}
 
 	RemoveIndex	= Queue->RemoveIndex;
@@ -160,6 +310,11 @@ int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, po
 
 	if( BufferSize < ItemLength )
 		{
+#if			!defined QUEUE_STRICT_CHRONOLOGY
+		/* If the item was granted to us, pass it on to the next reader in line. */
+		if( GrantReaders( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+			taskYIELD();
+#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
 		portEXIT_CRITICAL();
 		return -1;
 		}
@@ -179,6 +334,8 @@ int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, po
 	Queue->ItemsAvailable--;
 	Queue->BytesFree	+= EffectiveSize( ItemLength );
 
+	traceADDON( addontraceFQ_DEQUEUE, Queue, ItemLength );
+
 #if			defined QUEUE_STRICT_CHRONOLOGY
 	Queue->ReadingOwner		= NULL;
 	/*------------------------------------------------------------------------*/
@@ -196,12 +353,15 @@ int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, po
 @@@@*/
 			{
 			Queue->ReadingOwner	= p;
+			traceADDON_TASK( addontraceFQ_HANDOFF_READ, Queue, p, 0 );
 
+			traceADDON( addontraceFQ_WAKE_READER, Queue, 0 );
 			if( xTaskRemoveFromEventList( &Queue->TasksWaitingToRead ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
 				MustYield	= 1;
 
 			}
 		}
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 	/*------------------------------------------------------------------------*/
 	/*
 	 We removed some bytes from the buffer, there should be room for more items
@@ -209,18 +369,21 @@ int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, po
 	 its item will fit in the buffer.
 	*/
 	/*------------------------------------------------------------------------*/
+#if			defined QUEUE_STRICT_CHRONOLOGY
 	if( Queue->WritingOwner == NULL && ( p = (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToWrite )) != NULL
 		&& EffectiveSize( (unsigned int)pvGetExtraParameter( p )) <= Queue->BytesFree )
 		{
 		Queue->WritingOwner	= p;
-#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-	if( !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
-		{
-#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
+		traceADDON_TASK( addontraceFQ_HANDOFF_WRITE, Queue, p, 0 );
 
+		traceADDON( addontraceFQ_WAKE_WRITER, Queue, 0 );
 		if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
 			MustYield	= 1;
 		}
+#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
+	if( GrantWriters( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		MustYield	= 1;
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 
 	if( MustYield )
 		taskYIELD();
@@ -232,7 +395,9 @@ int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, po
 int xFlexiQueueReadFromISR( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize )
 	{
 	unsigned int	RemoveIndex, ItemLength, Aux, RemainingBytes;
+#if			defined QUEUE_STRICT_CHRONOLOGY
 	xTaskHandle		p;
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 
 	if( Queue == NULL )
 		return 0;
@@ -240,7 +405,7 @@ int xFlexiQueueReadFromISR( flexiqueue_t *Queue, void *Ptr, unsigned int BufferS
 #if			defined QUEUE_STRICT_CHRONOLOGY
 	if( Queue->ItemsAvailable == 0 || Queue->ReadingOwner != NULL || !listLIST_IS_EMPTY( &Queue->TasksWaitingToRead ))
 #else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-	if( Queue->ItemsAvailable == 0 )
+	if( Queue->ItemsAvailable <= Queue->ItemsReserved )
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 		return 0;
 
@@ -274,6 +439,8 @@ int xFlexiQueueReadFromISR( flexiqueue_t *Queue, void *Ptr, unsigned int BufferS
 	Queue->ItemsAvailable--;
 	Queue->BytesFree	+= EffectiveSize( ItemLength );
 
+	traceADDON_ISR( addontraceFQ_DEQUEUE, Queue, ItemLength );
+
 	/*------------------------------------------------------------------------*/
 	/*
 	 We removed some bytes from the buffer, there should be room for more items
@@ -286,22 +453,25 @@ int xFlexiQueueReadFromISR( flexiqueue_t *Queue, void *Ptr, unsigned int BufferS
 		&& EffectiveSize( (unsigned int)pvGetExtraParameter( p )) <= Queue->BytesFree )
 		{
 		Queue->WritingOwner	= p;
-#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-	if( !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
-		{
-#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
+		traceADDON_TASK( addontraceFQ_HANDOFF_WRITE, Queue, p, 0 );
 
+		traceADDON_ISR( addontraceFQ_WAKE_WRITER, Queue, 0 );
 		if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE )
 			return ItemLength | 0x40000000;
 		}
+#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
+	if( GrantWriters( Queue, 1 ))
+		return ItemLength | 0x40000000;
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 
 	return ItemLength;
 	}
 /*============================================================================*/
 int xFlexiQueueWrite( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize, portTickType  TimeToWait )
 	{
-	portTickType 		DeadLine;
-	xTaskHandle			*p;
+#if			defined QUEUE_STRICT_CHRONOLOGY
+	xTaskHandle			p;
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 	unsigned int		InsertIndex, Aux, RemainingBytes;
 	int					MustYield	= 0;
 
@@ -316,7 +486,8 @@ int xFlexiQueueWrite( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSiz
 #if			defined QUEUE_STRICT_CHRONOLOGY
 	if( EffectiveSize( ItemSize ) > Queue->BytesFree || Queue->WritingOwner != NULL || !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
 #else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-	if( EffectiveSize( ItemSize ) > Queue->BytesFree )
+	/* Don't jump ahead of the writers waiting for room, nor take room granted to them, nor write behind a reservation. */
+	if( EffectiveSize( ItemSize ) > Queue->BytesFree - Queue->BytesReserved || Queue->WriteReserved != 0 || !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 		{
 		if( TimeToWait == 0 )
@@ -325,31 +496,33 @@ int xFlexiQueueWrite( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSiz
 			return 0;
 			}
 
-		DeadLine	= xTaskGetTickCount() + TimeToWait;
+#if			defined QUEUE_STRICT_CHRONOLOGY
 		vSetExtraParameter( xTaskGetCurrentTaskHandle(), (void*)ItemSize );
 
-#if			!defined QUEUE_STRICT_CHRONOLOGY
-		do
-#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
-			{
-			vTaskPlaceOnEventList( &( Queue->TasksWaitingToWrite ), DeadLine );
+		traceADDON( addontraceFQ_BLOCK_WRITE, Queue, TimeToWait );
+		vTaskPlaceOnEventList( &( Queue->TasksWaitingToWrite ), TimeToWait );
 
-	        taskYIELD();
-	        }
-#if			!defined QUEUE_STRICT_CHRONOLOGY
-		while(( (signed long)TimeToWait < 0 || (signed long)( DeadLine - xTaskGetTickCount() ) > 0 ) && EffectiveSize( ItemSize ) > Queue->BytesFree );
-#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
+        taskYIELD();
 
-
-#if			defined QUEUE_STRICT_CHRONOLOGY
 		if( EffectiveSize( ItemSize ) > Queue->BytesFree || Queue->WritingOwner != xTaskGetCurrentTaskHandle() )
 #else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-		if( EffectiveSize( ItemSize ) > Queue->BytesFree )
+		if( !WaitForGrant( Queue, &Queue->TasksWaitingToWrite, ItemSize, TimeToWait ))
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 			{
+			traceADDON( addontraceFQ_TIMEOUT_WRITE, Queue, 0 );
+#if			!defined QUEUE_STRICT_CHRONOLOGY
+			/* We may have been holding back writers whose items fit. */
+			if( GrantWriters( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+				taskYIELD();
+#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
 			portEXIT_CRITICAL();
 			return 0;
 			}
+
+#if			!defined QUEUE_STRICT_CHRONOLOGY
+		/* The room was reserved for us when we were woken, a flush doesn't take it. */
+		Queue->BytesReserved   -= EffectiveSize( ItemSize );
+#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
 		}
 
 	Aux			= ItemSize - 1;
@@ -379,13 +552,17 @@ int xFlexiQueueWrite( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSiz
 	Queue->ItemsAvailable++;
 	Queue->BytesFree	-= EffectiveSize( ItemSize );
 
+	traceADDON( addontraceFQ_ENQUEUE, Queue, ItemSize );
+
 #if			defined QUEUE_STRICT_CHRONOLOGY
 	Queue->WritingOwner		= NULL;
 
 	if(( p = (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToWrite )) != NULL && EffectiveSize( (unsigned int)pvGetExtraParameter( p )) <= Queue->BytesFree )
 		{
 		Queue->WritingOwner	= p;
+		traceADDON_TASK( addontraceFQ_HANDOFF_WRITE, Queue, p, 0 );
 			
+		traceADDON( addontraceFQ_WAKE_WRITER, Queue, 0 );
 		if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
 			MustYield	= 1;
 
@@ -396,7 +573,7 @@ int xFlexiQueueWrite( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSiz
 	 a task wanting to read them.
 	*/
 	/*------------------------------------------------------------------------*/
-	if( Queue->ReadingOwner == NULL && ( p = listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToRead )) != NULL )
+	if( Queue->ReadingOwner == NULL && ( p = (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToRead )) != NULL )
 		{
 		/*
 		 Let's be practical, waking up a task that doesn't have room in its buffer
@@ -410,15 +587,25 @@ int xFlexiQueueWrite( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSiz
 @@@@*/
 			{
 			Queue->ReadingOwner	= p;
-#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-		if( !listLIST_IS_EMPTY( &Queue->TasksWaitingToRead ))
-			{
-#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
-			if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+			traceADDON_TASK( addontraceFQ_HANDOFF_READ, Queue, p, 0 );
+
+			traceADDON( addontraceFQ_WAKE_READER, Queue, 0 );
+			if( xTaskRemoveFromEventList( &Queue->TasksWaitingToRead ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
 				MustYield	= 1;
 			}
-#if			defined QUEUE_STRICT_CHRONOLOGY
 		}
+#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
+	/*------------------------------------------------------------------------*/
+	/*
+	 We inserted some bytes into the buffer, let's hand them to the reader at the
+	 head of the list, if any.
+	*/
+	/*------------------------------------------------------------------------*/
+	if( GrantReaders( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		MustYield	= 1;
+	/* A reservation waits for the writers granted before it, we may have been the last. */
+	if( GrantWriters( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		MustYield	= 1;
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 
 	if( MustYield )
@@ -430,7 +617,9 @@ int xFlexiQueueWrite( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSiz
 /*============================================================================*/
 int xFlexiQueueWriteFromISR( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize )
 	{
-	xTaskHandle		*p;
+#if			defined QUEUE_STRICT_CHRONOLOGY
+	xTaskHandle		p;
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 	unsigned int	InsertIndex, Aux, RemainingBytes;
 
 	if( Queue == NULL )
@@ -442,7 +631,7 @@ int xFlexiQueueWriteFromISR( flexiqueue_t *Queue, const void *Ptr, unsigned int
 #if			defined QUEUE_STRICT_CHRONOLOGY
 	if( EffectiveSize( ItemSize ) > Queue->BytesFree || Queue->WritingOwner != NULL || !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
 #else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-	if( EffectiveSize( ItemSize ) > Queue->BytesFree )
+	if( EffectiveSize( ItemSize ) > Queue->BytesFree - Queue->BytesReserved || Queue->WriteReserved != 0 || !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 		return 0;
 
@@ -462,6 +651,8 @@ int xFlexiQueueWriteFromISR( flexiqueue_t *Queue, const void *Ptr, unsigned int
 	Queue->ItemsAvailable++;
 	Queue->BytesFree	-= EffectiveSize( ItemSize );
 
+	traceADDON_ISR( addontraceFQ_ENQUEUE, Queue, ItemSize );
+
 #if			defined QUEUE_STRICT_CHRONOLOGY
 	/*------------------------------------------------------------------------*/
 	/*
@@ -469,7 +660,7 @@ int xFlexiQueueWriteFromISR( flexiqueue_t *Queue, const void *Ptr, unsigned int
 	 a task wanting to read them.
 	*/
 	/*------------------------------------------------------------------------*/
-	if( Queue->ReadingOwner == NULL && ( p = listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToRead )) != NULL )
+	if( Queue->ReadingOwner == NULL && ( p = (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToRead )) != NULL )
 		{
 		/*
 		 Let's be practical, waking up a task that doesn't have room in its buffer
@@ -483,23 +674,163 @@ int xFlexiQueueWriteFromISR( flexiqueue_t *Queue, const void *Ptr, unsigned int
 @@@@*/
 			{
 			Queue->ReadingOwner	= p;
-#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
-		if(!listLIST_IS_EMPTY( &Queue->TasksWaitingToRead ))
-			{
-#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
+			traceADDON_TASK( addontraceFQ_HANDOFF_READ, Queue, p, 0 );
+
+			traceADDON_ISR( addontraceFQ_WAKE_READER, Queue, 0 );
 			if( xTaskRemoveFromEventList( &Queue->TasksWaitingToRead ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IN_ISR ))
 					return 2;
 			}
-#if			defined QUEUE_STRICT_CHRONOLOGY
 		}
+#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
+	if( GrantReaders( Queue, 1 ) && ( Queue->Mode & QUEUE_SWITCH_IN_ISR ))
+		return 2;
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 
 	return 1;
 	}
 /*============================================================================*/
+#if			!defined QUEUE_STRICT_CHRONOLOGY
+/*============================================================================*/
+/* Points Reservation to the room after the length header at InsertIndex. */
+/*============================================================================*/
+static void FillReservation( flexiqueue_t *Queue, flexiqueue_reservation_t *Reservation, unsigned int ItemSize )
+	{
+	unsigned int	Index;
+
+	Index	= Queue->InsertIndex + ( ItemSize > 128 ? 2 : 1 );
+	if( Index >= Queue->QueueLength )
+		Index  -= Queue->QueueLength;
+
+	Reservation->Data[0]	= &Queue->QueueBuffer[ Index ];
+	Reservation->Length[0]	= min( ItemSize, Queue->QueueLength - Index );
+	Reservation->Data[1]	= Queue->QueueBuffer;
+	Reservation->Length[1]	= ItemSize - Reservation->Length[0];
+	}
+/*============================================================================*/
+int xFlexiQueueReserve( flexiqueue_t *Queue, flexiqueue_reservation_t *Reservation, unsigned int ItemSize, portTickType TimeToWait )
+	{
+	if( Queue == NULL )
+		return 0;
+
+	if( EffectiveSize( ItemSize ) > Queue->QueueLength )
+		return -1;
+
+	portENTER_CRITICAL();
+
+	/* The item goes at InsertIndex, so the writers granted room must write theirs first. */
+	if( EffectiveSize( ItemSize ) > Queue->BytesFree || Queue->BytesReserved != 0 || Queue->WriteReserved != 0 || !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
+		{
+		if( TimeToWait == 0 )
+			{
+			portEXIT_CRITICAL();
+			return 0;
+			}
+
+		/* GrantWriters opens the reservation for us. */
+		if( !WaitForGrant( Queue, &Queue->TasksWaitingToWrite, ItemSize | WAIT_RESERVE, TimeToWait ))
+			{
+			traceADDON( addontraceFQ_TIMEOUT_WRITE, Queue, 0 );
+			/* We may have been holding back writers whose items fit. */
+			if( GrantWriters( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+				taskYIELD();
+			portEXIT_CRITICAL();
+			return 0;
+			}
+		}
+	else
+		{
+		Queue->BytesFree	   -= EffectiveSize( ItemSize );
+		Queue->WriteReserved	= EffectiveSize( ItemSize );
+		}
+
+	FillReservation( Queue, Reservation, ItemSize );
+
+	portEXIT_CRITICAL();
+	return 1;
+	}
+/*============================================================================*/
+int xFlexiQueueCommit( flexiqueue_t *Queue )
+	{
+	unsigned int	ItemSize, InsertIndex, Aux;
+	int				MustYield	= 0;
+
+	if( Queue == NULL )
+		return 0;
+
+	portENTER_CRITICAL();
+
+	if( Queue->WriteReserved == 0 )
+		{
+		portEXIT_CRITICAL();
+		return 0;
+		}
+
+	/* The item is already in place, only its length header is missing. */
+	ItemSize	= Queue->WriteReserved - ( Queue->WriteReserved > 129 ? 2 : 1 );
+	Aux			= ItemSize - 1;
+	InsertIndex	= Queue->InsertIndex;
+	Queue->QueueBuffer[ InsertIndex ]	= ItemSize > 128 ? (unsigned char)( Aux | 0x80 ) : (unsigned char)( Aux & 0x7f );
+	if( ++InsertIndex >= Queue->QueueLength )
+		InsertIndex	= 0;
+	if( ItemSize > 128 )
+		{
+		Queue->QueueBuffer[ InsertIndex ]	= (unsigned char)( Aux >> 7 );
+		if( ++InsertIndex >= Queue->QueueLength )
+			InsertIndex	= 0;
+		}
+	if(( InsertIndex += ItemSize ) >= Queue->QueueLength )
+		InsertIndex	-= Queue->QueueLength;
+
+	Queue->InsertIndex		= InsertIndex;
+	Queue->WriteReserved	= 0;
+
+	Queue->ItemsAvailable++;
+
+	traceADDON( addontraceFQ_ENQUEUE, Queue, ItemSize );
+
+	if( GrantReaders( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		MustYield	= 1;
+	/* The write side is free again. */
+	if( GrantWriters( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		MustYield	= 1;
+
+	if( MustYield )
+		taskYIELD();
+
+	portEXIT_CRITICAL();
+	return 1;
+	}
+/*============================================================================*/
+int xFlexiQueueCancel( flexiqueue_t *Queue )
+	{
+	if( Queue == NULL )
+		return 0;
+
+	portENTER_CRITICAL();
+
+	if( Queue->WriteReserved == 0 )
+		{
+		portEXIT_CRITICAL();
+		return 0;
+		}
+
+	Queue->BytesFree	   += Queue->WriteReserved;
+	Queue->WriteReserved	= 0;
+
+	if( GrantWriters( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		taskYIELD();
+
+	portEXIT_CRITICAL();
+	return 1;
+	}
+/*============================================================================*/
+#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
+/*============================================================================*/
 int xFlexiQueueFlush( flexiqueue_t *Queue, int Flag )
 	{
-	xTaskHandle			*p;
+#if			defined QUEUE_STRICT_CHRONOLOGY
+	xTaskHandle			p;
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 	int					MustYield	= 0;
 	int					f = 0;
 
@@ -508,19 +839,35 @@ int xFlexiQueueFlush( flexiqueue_t *Queue, int Flag )
 
 	portENTER_CRITICAL();
 
+	traceADDON( addontraceFQ_FLUSH, Queue, Flag );
+
 	Queue->ItemsAvailable	= 0;
+	Queue->BytesFree		= Queue->QueueLength;
+#if			defined QUEUE_STRICT_CHRONOLOGY
 	Queue->RemoveIndex		= 0;
 	Queue->InsertIndex		= 0;
-#if			defined QUEUE_STRICT_CHRONOLOGY
 	Queue->ReadingOwner		= NULL;
 	Queue->WritingOwner		= NULL;
+#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
+	/* An open reservation keeps its place and its room. */
+	if( Queue->WriteReserved != 0 )
+		Queue->BytesFree   -= Queue->WriteReserved;
+	else
+		Queue->InsertIndex	= 0;
+	Queue->RemoveIndex		= Queue->InsertIndex;
+	/* Readers granted an item but not run yet will find it gone; the room granted to writers is still theirs. */
+	Queue->Flushes++;
+	Queue->ItemsReserved	= 0;
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
-	Queue->BytesFree		= Queue->QueueLength;
 
 	if( Flag & QUEUE_FLUSH_READING_TASKS )
 		while( !listLIST_IS_EMPTY( &Queue->TasksWaitingToRead ))
 			{
 			f	|= QUEUE_FLUSH_READING_TASKS;
+#if			!defined QUEUE_STRICT_CHRONOLOGY
+			vSetExtraParameter( (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToRead ), WAIT_FLUSHED );
+#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
+			traceADDON( addontraceFQ_WAKE_READER, Queue, 0 );
 			if( xTaskRemoveFromEventList( &Queue->TasksWaitingToRead ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
 				MustYield	= 1;
 			}
@@ -530,6 +877,10 @@ int xFlexiQueueFlush( flexiqueue_t *Queue, int Flag )
 		while( !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
 			{
 			f	|= QUEUE_FLUSH_WRITING_TASKS;
+#if			!defined QUEUE_STRICT_CHRONOLOGY
+			vSetExtraParameter( (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToWrite ), WAIT_FLUSHED );
+#endif	/*	!defined QUEUE_STRICT_CHRONOLOGY */
+			traceADDON( addontraceFQ_WAKE_WRITER, Queue, 0 );
 			if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
 				MustYield	= 1;
 			}
@@ -538,10 +889,15 @@ int xFlexiQueueFlush( flexiqueue_t *Queue, int Flag )
 	else if(( p = (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToWrite )) != NULL )
 		{
 		Queue->WritingOwner	= p;
+		traceADDON_TASK( addontraceFQ_HANDOFF_WRITE, Queue, p, 0 );
 
+		traceADDON( addontraceFQ_WAKE_WRITER, Queue, 0 );
 		if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
 			MustYield	= 1;
 		}
+#else	/*	defined QUEUE_STRICT_CHRONOLOGY */
+	else if( GrantWriters( Queue, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		MustYield	= 1;
 #endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
 
 	if( MustYield )
@@ -552,3 +908,5 @@ int xFlexiQueueFlush( flexiqueue_t *Queue, int Flag )
 	return f;
 	}
 /*============================================================================*/
+#endif	/*	!defined QUEUE_SMP */
+/*============================================================================*/
@@ -32,7 +32,12 @@ isaacbavaresco@yahoo.com.br
 #if         !defined __FLEXIQUEUE_H__
 #define __FLEXIQUEUE_H__
 /*============================================================================*/
-#include "SimpleRTOS.h"
+#include "FreeRTOS.h"
+#include "list.h"
+#include "task.h"
+#if         defined QUEUE_SMP
+#include "spinlock.h"
+#endif  /*  defined QUEUE_SMP */
 /*============================================================================*/
 
 /* In this mode, a higher priority task awaken will only run in the next tick */
@@ -56,11 +61,11 @@ isaacbavaresco@yahoo.com.br
 typedef struct
     {
 #if         defined QUEUE_STRICT_CHRONOLOGY
-    context_t       *WritingOwner;
-    context_t       *ReadingOwner;
+    xTaskHandle     WritingOwner;
+    xTaskHandle     ReadingOwner;
 #endif  /*  defined QUEUE_STRICT_CHRONOLOGY */
-    context_t       *TasksWaitingToWrite;
-    context_t       *TasksWaitingToRead;
+    xList           TasksWaitingToWrite;
+    xList           TasksWaitingToRead;
     unsigned int    QueueLength;
     unsigned char   *QueueBuffer;
     unsigned int    BytesFree;
@@ -68,16 +73,66 @@ typedef struct
     unsigned int    RemoveIndex;
     unsigned int    InsertIndex;
     int             Mode;
+#if         !defined QUEUE_STRICT_CHRONOLOGY && !defined QUEUE_SMP
+    unsigned int    ItemsReserved;      /* Items handed to woken readers that have not run yet */
+    unsigned int    BytesReserved;      /* Room handed to woken writers that have not run yet */
+    unsigned int    Flushes;            /* Flush count, stamped on the grants to readers */
+    unsigned int    WriteReserved;      /* Bytes taken by an open reservation, zero if none */
+#endif  /*  !defined QUEUE_STRICT_CHRONOLOGY && !defined QUEUE_SMP */
+#if         defined QUEUE_SMP
+    xSpinLock       Lock;
+    unsigned int    WriteReserved;      /* Bytes taken by the write being copied or reserved, zero if none */
+    unsigned char   ReadBusy;           /* A reader owns the item at RemoveIndex */
+    unsigned char   FlushPending;       /* Flush requested while ReadBusy, done when the read ends */
+    unsigned int    FlushIndex;         /* InsertIndex when the pending flush was requested */
+    unsigned int    FlushItems;         /* Items and bytes committed before it, to be discarded */
+    unsigned int    FlushBytes;
+    unsigned short  ReadersWaiting;     /* Hints for skipping the kernel lock when nobody is blocked */
+    unsigned short  WritersWaiting;
+#endif  /*  defined QUEUE_SMP */
     } flexiqueue_t;
 
 /*============================================================================*/
+#if         !defined QUEUE_STRICT_CHRONOLOGY
 
-void    FlexiQueueInit          ( flexiqueue_t *Queue, unsigned int QueueLength, void *QueueBuffer, int Mode );
-int     FlexiQueueRead          ( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, tickcount_t TimeToWait );
-int     FlexiQueueReadFromISR   ( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize );
-int     FlexiQueueWrite         ( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize, tickcount_t TimeToWait );
-int     FlexiQueueWriteFromISR  ( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize );
-int     FlexiQueueFlush         ( flexiqueue_t *Queue, int Flag );
+/*
+ Where a reserved item goes in the queue's buffer: its first Length[0] bytes at
+ Data[0] and the rest, if it wraps around the end of the buffer, at Data[1].
+*/
+typedef struct
+    {
+    unsigned char   *Data[ 2 ];
+    unsigned int    Length[ 2 ];
+    } flexiqueue_reservation_t;
+
+#endif  /*  !defined QUEUE_STRICT_CHRONOLOGY */
+/*============================================================================*/
+#if         defined __cplusplus
+extern "C" {
+#endif  /*  defined __cplusplus */
+
+flexiqueue_t    *xFlexiQueueCreate      ( unsigned int QueueLength, int Mode );
+int             xFlexiQueueRead         ( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, portTickType TimeToWait );
+int             xFlexiQueueReadFromISR  ( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize );
+int             xFlexiQueueWrite        ( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize, portTickType TimeToWait );
+int             xFlexiQueueWriteFromISR ( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize );
+int             xFlexiQueueFlush        ( flexiqueue_t *Queue, int Flag );
+
+#if         !defined QUEUE_STRICT_CHRONOLOGY
+/*
+ xFlexiQueueReserve takes room for an item of ItemSize bytes, to be filled in
+ place and then committed or cancelled by the same task. Until then the queue's
+ write side is held: other writers wait and the FromISR writes find the queue
+ full. Returns as xFlexiQueueWrite.
+*/
+int             xFlexiQueueReserve      ( flexiqueue_t *Queue, flexiqueue_reservation_t *Reservation, unsigned int ItemSize, portTickType TimeToWait );
+int             xFlexiQueueCommit       ( flexiqueue_t *Queue );
+int             xFlexiQueueCancel       ( flexiqueue_t *Queue );
+#endif  /*  !defined QUEUE_STRICT_CHRONOLOGY */
+
+#if         defined __cplusplus
+}
+#endif  /*  defined __cplusplus */
 
 /*============================================================================*/
 #endif  /*  !defined __FLEXIQUEUE_H__ */
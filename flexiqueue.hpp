@@ -0,0 +1,352 @@
+/*============================================================================*/
+/*
+ Copyright (c) 2007-2014, Isaac Marino Bavaresco
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of the author nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE AUTHOR ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*============================================================================*/
+/*
+ Typed C++ (C++17) layer over flexiqueue.h, header only.
+
+ Items are trivially copyable types, so their size and the size they take in
+ the buffer (length header included) are known at compile time, and the items
+ are copied straight between the caller's object and the queue's buffer.
+
+ Queue<T> carries a single type. VariantQueue<Ts...> carries any of Ts, each
+ item followed by a one-byte tag that selects the type on the way out; the
+ length header still makes the item take only the bytes of its own type.
+
+ A Draft is an item being built for a queue that has already reserved the room
+ for it (xFlexiQueueReserve), so its Commit can't fail. The item is constructed
+ from the arguments given to Reserve, so T needs no default constructor unless
+ Reserve is called without any, and is built in the draft itself: the room in
+ the buffer is neither aligned for T nor always contiguous. Commit copies it
+ there. A draft dropped without being committed cancels the reservation. The
+ reservation holds the queue's write side, so keep drafts short-lived. Drafts
+ are not available with QUEUE_STRICT_CHRONOLOGY.
+
+ The wrappers are handles, like flexiqueue_t*: copying them doesn't copy the
+ queue, and there is no way to delete a FlexiQueue.
+*/
+/*============================================================================*/
+#if         !defined __FLEXIQUEUE_HPP__
+#define __FLEXIQUEUE_HPP__
+/*============================================================================*/
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include "flexiqueue.h"
+/*============================================================================*/
+namespace addons
+{
+/*============================================================================*/
+/* Bytes an item of s bytes takes in the buffer, as in flexiqueue.c. */
+constexpr unsigned int EffectiveSize( unsigned int s )
+	{
+	return s + ( s > 128 ? 2 : 1 );
+	}
+
+/* The two-byte length header holds sizes up to 32768. */
+constexpr unsigned int MaxItemSize	= 0x8000;
+/*============================================================================*/
+template<typename T> class Queue;
+template<typename... Ts> class VariantQueue;
+/*============================================================================*/
+namespace detail
+{
+/*
+ An item followed by its tag, if any, with no padding between them. The item is
+ left unconstructed until it is placed there.
+*/
+template<typename T>
+struct Slot
+	{
+	Slot() {}
+
+	union
+		{
+		T	Item;
+		};
+	unsigned char	Tag;
+	};
+}	/* namespace detail */
+/*============================================================================*/
+#if         !defined QUEUE_STRICT_CHRONOLOGY
+template<typename T>
+class Draft
+	{
+	public:
+		Draft( Draft &&Other ) noexcept
+			: Handle( Other.Handle ), Reservation( Other.Reservation ), Contents( Other.Contents )
+			{
+			Other.Handle	= nullptr;
+			}
+
+		Draft( const Draft & )				= delete;
+		Draft &operator=( const Draft & )	= delete;
+		Draft &operator=( Draft && )		= delete;
+
+		~Draft()
+			{
+			if( Handle != nullptr )
+				xFlexiQueueCancel( Handle );
+			}
+
+		/* False if the queue stayed full for TimeToWait, or already committed. */
+		explicit operator bool() const	{ return Handle != nullptr; }
+
+		T &operator*()				{ return Contents.Item; }
+		T *operator->()				{ return &Contents.Item; }
+
+		/* False only if there is no reservation to commit. */
+		bool Commit()
+			{
+			const unsigned char	*p = reinterpret_cast<const unsigned char*>( &Contents );
+
+			if( Handle == nullptr )
+				return false;
+			std::memcpy( Reservation.Data[0], p, Reservation.Length[0] );
+			std::memcpy( Reservation.Data[1], p + Reservation.Length[0], Reservation.Length[1] );
+			xFlexiQueueCommit( Handle );
+			Handle	= nullptr;
+			return true;
+			}
+
+	private:
+		template<typename> friend class Queue;
+		template<typename...> friend class VariantQueue;
+
+		/* Size is sizeof( T ), plus one if the tag goes too. */
+		template<typename... Args>
+		Draft( flexiqueue_t *Handle, unsigned int Size, unsigned char Tag, portTickType TimeToWait, Args &&...A )
+			: Handle( nullptr )
+			{
+			::new( static_cast<void*>( &Contents.Item )) T( std::forward<Args>( A )... );
+			Contents.Tag	= Tag;
+			if( xFlexiQueueReserve( Handle, &Reservation, Size, TimeToWait ) == 1 )
+				this->Handle	= Handle;
+			}
+
+		flexiqueue_t				*Handle;
+		flexiqueue_reservation_t	Reservation;
+		detail::Slot<T>				Contents;
+	};
+#endif  /*  !defined QUEUE_STRICT_CHRONOLOGY */
+/*============================================================================*/
+template<typename T>
+class Queue
+	{
+	static_assert( std::is_trivially_copyable<T>::value, "FlexiQueue items are copied byte by byte" );
+	static_assert( sizeof( T ) <= MaxItemSize, "Item too large for the FlexiQueue length header" );
+
+	public:
+		static constexpr unsigned int	ItemSize	= sizeof( T );
+		static constexpr unsigned int	SlotSize	= EffectiveSize( ItemSize );
+
+		explicit Queue( flexiqueue_t *Handle = nullptr ) : Handle( Handle ) {}
+
+		/* A queue whose buffer holds exactly Items items. */
+		static Queue Create( unsigned int Items, int Mode = QUEUE_NORMAL )
+			{
+			return Queue( xFlexiQueueCreate( Items * SlotSize, Mode ));
+			}
+
+		flexiqueue_t	*Get() const			{ return Handle; }
+		explicit		operator bool() const	{ return Handle != nullptr; }
+
+		bool Write( const T &Item, portTickType TimeToWait = 0 )
+			{
+			return xFlexiQueueWrite( Handle, &Item, ItemSize, TimeToWait ) == 1;
+			}
+
+		/* Returns as xFlexiQueueWriteFromISR. */
+		int WriteFromISR( const T &Item )
+			{
+			return xFlexiQueueWriteFromISR( Handle, &Item, ItemSize );
+			}
+
+		bool Read( T &Item, portTickType TimeToWait = 0 )
+			{
+			return xFlexiQueueRead( Handle, &Item, ItemSize, TimeToWait ) == (int)ItemSize;
+			}
+
+		/* Returns as xFlexiQueueReadFromISR. */
+		int ReadFromISR( T &Item )
+			{
+			return xFlexiQueueReadFromISR( Handle, &Item, ItemSize );
+			}
+
+#if         !defined QUEUE_STRICT_CHRONOLOGY
+		/* The item is constructed from A, value-initialized if there is none. */
+		template<typename... Args>
+		Draft<T> Reserve( portTickType TimeToWait, Args &&...A )
+			{
+			return Draft<T>( Handle, ItemSize, 0, TimeToWait, std::forward<Args>( A )... );
+			}
+#endif  /*  !defined QUEUE_STRICT_CHRONOLOGY */
+
+		int Flush( int Flag = QUEUE_FLUSH_DATA_ONLY )
+			{
+			return xFlexiQueueFlush( Handle, Flag );
+			}
+
+	private:
+		flexiqueue_t	*Handle;
+	};
+/*============================================================================*/
+namespace detail
+{
+template<typename T, typename... Ts>
+struct IndexOf;
+
+template<typename T, typename... Ts>
+struct IndexOf<T, T, Ts...> : std::integral_constant<unsigned int, 0> {};
+
+template<typename T, typename U, typename... Ts>
+struct IndexOf<T, U, Ts...> : std::integral_constant<unsigned int, 1 + IndexOf<T, Ts...>::value> {};
+}	/* namespace detail */
+/*============================================================================*/
+template<typename... Ts>
+class VariantQueue
+	{
+	static_assert( sizeof...( Ts ) >= 1 && sizeof...( Ts ) <= 256, "The tag is a single byte" );
+	static_assert(( std::is_trivially_copyable<Ts>::value && ... ), "FlexiQueue items are copied byte by byte" );
+	static_assert((( sizeof( Ts ) + 1 <= MaxItemSize ) && ... ), "Item too large for the FlexiQueue length header" );
+
+	public:
+		/* Largest item, tag included, and the buffer room it takes. */
+		static constexpr unsigned int	MaxSize		= std::max({ (unsigned int)sizeof( Ts )... }) + 1;
+		static constexpr unsigned int	MaxSlotSize	= EffectiveSize( MaxSize );
+
+		template<typename T>
+		static constexpr unsigned char	TagOf		= (unsigned char)detail::IndexOf<T, Ts...>::value;
+
+		template<typename T>
+		static constexpr unsigned int	SlotSize	= EffectiveSize( sizeof( T ) + 1 );
+
+		explicit VariantQueue( flexiqueue_t *Handle = nullptr ) : Handle( Handle ) {}
+
+		/* A queue whose buffer holds at least Items items of any type. */
+		static VariantQueue Create( unsigned int Items, int Mode = QUEUE_NORMAL )
+			{
+			return VariantQueue( xFlexiQueueCreate( Items * MaxSlotSize, Mode ));
+			}
+
+		flexiqueue_t	*Get() const			{ return Handle; }
+		explicit		operator bool() const	{ return Handle != nullptr; }
+
+#if         !defined QUEUE_STRICT_CHRONOLOGY
+		/* The item is constructed from A, value-initialized if there is none. */
+		template<typename T, typename... Args>
+		Draft<T> Reserve( portTickType TimeToWait, Args &&...A )
+			{
+			static_assert(( std::is_same<T, Ts>::value + ... ) == 1, "Type not carried by this queue, or listed twice" );
+			return Draft<T>( Handle, sizeof( T ) + 1, TagOf<T>, TimeToWait, std::forward<Args>( A )... );
+			}
+#endif  /*  !defined QUEUE_STRICT_CHRONOLOGY */
+
+		template<typename T>
+		bool Write( const T &Item, portTickType TimeToWait = 0 )
+			{
+			detail::Slot<T>	Contents	= Tagged( Item );
+
+			return xFlexiQueueWrite( Handle, &Contents, sizeof( T ) + 1, TimeToWait ) == 1;
+			}
+
+		/* Returns as xFlexiQueueWriteFromISR. */
+		template<typename T>
+		int WriteFromISR( const T &Item )
+			{
+			detail::Slot<T>	Contents	= Tagged( Item );
+
+			return xFlexiQueueWriteFromISR( Handle, &Contents, sizeof( T ) + 1 );
+			}
+
+		/*
+		 Reads the next item and calls Visitor with a const reference to it,
+		 which is valid only during the call. Returns the item's length, zero
+		 on timeout, -1 if the item is not one of Ts (it is consumed), or
+		 TooLong if it is longer than any of Ts. Such an item was not written
+		 through this class and can't be taken out of the queue by reading, so
+		 every read fails the same way until the queue is flushed.
+		*/
+		static constexpr int			TooLong		= -2;
+
+		template<typename Visitor>
+		int Read( Visitor &&V, portTickType TimeToWait = 0 )
+			{
+			alignas( Ts... ) unsigned char	Buffer[ MaxSize ];
+			int								Length;
+
+			if(( Length = xFlexiQueueRead( Handle, Buffer, MaxSize, TimeToWait )) <= 0 )
+				return Length < 0 ? TooLong : Length;
+
+			return Dispatch( Buffer, Length, V, std::make_integer_sequence<unsigned int, sizeof...( Ts )>() ) ? Length : -1;
+			}
+
+		/* As Read, returns as xFlexiQueueReadFromISR, or TooLong. */
+		template<typename Visitor>
+		int ReadFromISR( Visitor &&V )
+			{
+			alignas( Ts... ) unsigned char	Buffer[ MaxSize ];
+			int								Result;
+
+			if(( Result = xFlexiQueueReadFromISR( Handle, Buffer, MaxSize )) <= 0 )
+				return Result < 0 ? TooLong : Result;
+
+			return Dispatch( Buffer, Result & ~0x40000000, V, std::make_integer_sequence<unsigned int, sizeof...( Ts )>() ) ? Result : -1;
+			}
+
+		int Flush( int Flag = QUEUE_FLUSH_DATA_ONLY )
+			{
+			return xFlexiQueueFlush( Handle, Flag );
+			}
+
+	private:
+		template<typename T>
+		static detail::Slot<T> Tagged( const T &Item )
+			{
+			static_assert(( std::is_same<T, Ts>::value + ... ) == 1, "Type not carried by this queue, or listed twice" );
+
+			detail::Slot<T>	Contents;
+
+			::new( static_cast<void*>( &Contents.Item )) T( Item );
+			Contents.Tag	= TagOf<T>;
+			return Contents;
+			}
+
+		template<typename Visitor, unsigned int... I>
+		static bool Dispatch( const unsigned char *Buffer, unsigned int Length, Visitor &V, std::integer_sequence<unsigned int, I...> )
+			{
+			const unsigned char	Tag	= Buffer[ Length - 1 ];
+
+			return (( Tag == I && Length == sizeof( Ts ) + 1 && ( V( *std::launder( reinterpret_cast<const Ts*>( Buffer ))), true )) || ... );
+			}
+
+		flexiqueue_t	*Handle;
+	};
+/*============================================================================*/
+}	/* namespace addons */
+/*============================================================================*/
+#endif  /*  !defined __FLEXIQUEUE_HPP__ */
+/*============================================================================*/
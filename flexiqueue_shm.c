@@ -0,0 +1,473 @@
+/*============================================================================*/
+/*
+ Copyright (c) 2007-2014, Isaac Marino Bavaresco
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of the author nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE AUTHOR ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*============================================================================*/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+/*============================================================================*/
+#include "flexiqueue_shm.h"
+/*============================================================================*/
+static inline __attribute((always_inline)) unsigned int EffectiveSize( unsigned int s )
+	{
+	return s + ( s > 128 ? 2 : 1 );
+	}
+/*============================================================================*/
+static inline __attribute((always_inline)) unsigned int min( unsigned int a, unsigned int b )
+	{
+	return a < b ? a : b;
+	}
+/*============================================================================*/
+static int FutexWait( volatile unsigned int *Word, unsigned int Value, const struct timespec *DeadLine )
+	{
+	/* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC time-out. The kernel compares the word as a u32. */
+	if( syscall( SYS_futex, Word, FUTEX_WAIT_BITSET, (int)Value, DeadLine, NULL, FUTEX_BITSET_MATCH_ANY ) == 0 )
+		return 0;
+	return errno;
+	}
+/*============================================================================*/
+static void FutexWake( volatile unsigned int *Word, int Count )
+	{
+	syscall( SYS_futex, Word, FUTEX_WAKE, Count, NULL, NULL, 0 );
+	}
+/*============================================================================*/
+static void GetDeadLine( struct timespec *DeadLine, long TimeToWait )
+	{
+	clock_gettime( CLOCK_MONOTONIC, DeadLine );
+	DeadLine->tv_sec	+= TimeToWait / 1000;
+	DeadLine->tv_nsec	+= ( TimeToWait % 1000 ) * 1000000L;
+	if( DeadLine->tv_nsec >= 1000000000L )
+		{
+		DeadLine->tv_sec++;
+		DeadLine->tv_nsec	-= 1000000000L;
+		}
+	}
+/*============================================================================*/
+static unsigned int ReadItemHeader( shmflexiqueue_hdr_t *q, unsigned int *Index )
+	{
+	unsigned int	RemoveIndex, ItemLength;
+
+	RemoveIndex	= *Index;
+	ItemLength	= (unsigned short)q->QueueBuffer[ RemoveIndex ];
+	if( ++RemoveIndex >= q->QueueLength )
+		RemoveIndex	= 0;
+	if( ItemLength > 127 )
+		{
+		ItemLength	= ( ItemLength & 0x7f ) | ( (unsigned short)q->QueueBuffer[ RemoveIndex ] << 7 );
+		if( ++RemoveIndex >= q->QueueLength )
+			RemoveIndex	= 0;
+		}
+	*Index	= RemoveIndex;
+	return ItemLength + 1;
+	}
+/*============================================================================*/
+static void ResetQueue( shmflexiqueue_hdr_t *q )
+	{
+	q->ItemsAvailable	= 0;
+	q->RemoveIndex		= 0;
+	q->InsertIndex		= 0;
+	q->BytesFree		= q->QueueLength;
+	}
+/*============================================================================*/
+/*
+ Walks all the items in the queue checking that the indices and counters agree
+ with each other. Used only after a peer died while holding the lock, when any
+ of the fields may have been left half-updated.
+*/
+/*============================================================================*/
+static int IsConsistent( shmflexiqueue_hdr_t *q )
+	{
+	unsigned int	Index, ItemLength, BytesUsed, n;
+
+	if( q->BytesFree > q->QueueLength || q->RemoveIndex >= q->QueueLength || q->InsertIndex >= q->QueueLength )
+		return 0;
+
+	Index		= q->RemoveIndex;
+	BytesUsed	= 0;
+	for( n = 0; n < q->ItemsAvailable; n++ )
+		{
+		ItemLength	= ReadItemHeader( q, &Index );
+		BytesUsed  += EffectiveSize( ItemLength );
+		if( BytesUsed > q->QueueLength - q->BytesFree )
+			return 0;
+		if(( Index += ItemLength ) >= q->QueueLength )
+			Index  -= q->QueueLength;
+		}
+
+	return BytesUsed == q->QueueLength - q->BytesFree && Index == q->InsertIndex;
+	}
+/*============================================================================*/
+static int Lock( shmflexiqueue_hdr_t *q )
+	{
+	int	Result;
+
+	Result	= pthread_mutex_lock( &q->Lock );
+	if( Result == EOWNERDEAD )
+		{
+		/*
+		 The previous owner died inside a critical section. Keep the items if
+		 the control block is still coherent, otherwise discard everything.
+		 Either way, kick all waiters so they re-evaluate the queue state.
+		*/
+		if( !IsConsistent( q ))
+			ResetQueue( q );
+		q->Recoveries++;
+		q->ReadSequence++;
+		q->WriteSequence++;
+		FutexWake( &q->ReadSequence, INT_MAX );
+		FutexWake( &q->WriteSequence, INT_MAX );
+		pthread_mutex_consistent( &q->Lock );
+		return 0;
+		}
+
+	return Result;
+	}
+/*============================================================================*/
+static void Unlock( shmflexiqueue_hdr_t *q )
+	{
+	pthread_mutex_unlock( &q->Lock );
+	}
+/*============================================================================*/
+shmflexiqueue_t *xShmFlexiQueueCreate( const char *Name, unsigned int QueueLength )
+	{
+	shmflexiqueue_t		*Queue;
+	shmflexiqueue_hdr_t	*q;
+	pthread_mutexattr_t	Attr;
+	size_t				MapSize;
+	int					fd;
+
+	MapSize	= sizeof( shmflexiqueue_hdr_t ) + QueueLength;
+
+	Queue	= malloc( sizeof( shmflexiqueue_t ));
+	if( Queue == NULL )
+		return NULL;
+
+	fd		= shm_open( Name, O_RDWR | O_CREAT | O_EXCL, 0600 );
+	if( fd < 0 )
+		{
+		free( Queue );
+		return NULL;
+		}
+
+	if( ftruncate( fd, MapSize ) < 0 || ( q = mmap( NULL, MapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )) == MAP_FAILED )
+		{
+		close( fd );
+		shm_unlink( Name );
+		free( Queue );
+		return NULL;
+		}
+	close( fd );
+
+	pthread_mutexattr_init( &Attr );
+	pthread_mutexattr_setpshared( &Attr, PTHREAD_PROCESS_SHARED );
+	pthread_mutexattr_setrobust( &Attr, PTHREAD_MUTEX_ROBUST );
+	pthread_mutex_init( &q->Lock, &Attr );
+	pthread_mutexattr_destroy( &Attr );
+
+	q->Version			= SHM_QUEUE_VERSION;
+	q->QueueLength		= QueueLength;
+	q->ReadSequence		= 0;
+	q->WriteSequence	= 0;
+	q->ReadersWaiting	= 0;
+	q->WritersWaiting	= 0;
+	q->Recoveries		= 0;
+	ResetQueue( q );
+
+	/* Publish the control block only after it is fully initialized. */
+	__atomic_store_n( &q->Magic, SHM_QUEUE_MAGIC, __ATOMIC_RELEASE );
+
+	Queue->Header		= q;
+	Queue->MapSize		= MapSize;
+
+	return Queue;
+	}
+/*============================================================================*/
+shmflexiqueue_t *xShmFlexiQueueOpen( const char *Name )
+	{
+	shmflexiqueue_t		*Queue;
+	shmflexiqueue_hdr_t	*q;
+	struct stat			st;
+	int					fd;
+
+	Queue	= malloc( sizeof( shmflexiqueue_t ));
+	if( Queue == NULL )
+		return NULL;
+
+	fd		= shm_open( Name, O_RDWR, 0 );
+	if( fd < 0 )
+		{
+		free( Queue );
+		return NULL;
+		}
+
+	if( fstat( fd, &st ) < 0 || (size_t)st.st_size < sizeof( shmflexiqueue_hdr_t ) || ( q = mmap( NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 )) == MAP_FAILED )
+		{
+		close( fd );
+		free( Queue );
+		return NULL;
+		}
+	close( fd );
+
+	if( __atomic_load_n( &q->Magic, __ATOMIC_ACQUIRE ) != SHM_QUEUE_MAGIC || q->Version != SHM_QUEUE_VERSION
+		|| sizeof( shmflexiqueue_hdr_t ) + q->QueueLength > (size_t)st.st_size )
+		{
+		munmap( q, st.st_size );
+		free( Queue );
+		return NULL;
+		}
+
+	Queue->Header		= q;
+	Queue->MapSize		= st.st_size;
+
+	return Queue;
+	}
+/*============================================================================*/
+void vShmFlexiQueueClose( shmflexiqueue_t *Queue )
+	{
+	if( Queue == NULL )
+		return;
+
+	munmap( Queue->Header, Queue->MapSize );
+	free( Queue );
+	}
+/*============================================================================*/
+int xShmFlexiQueueUnlink( const char *Name )
+	{
+	return shm_unlink( Name ) == 0;
+	}
+/*============================================================================*/
+int xShmFlexiQueueRead( shmflexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, long TimeToWait )
+	{
+	shmflexiqueue_hdr_t	*q;
+	struct timespec		DeadLine;
+	unsigned int		RemoveIndex, ItemLength, Aux, RemainingBytes, Sequence;
+	int					Result;
+
+	if( Queue == NULL )
+		return 0;
+
+	q	= Queue->Header;
+
+	if( TimeToWait > 0 )
+		GetDeadLine( &DeadLine, TimeToWait );
+
+	if( Lock( q ) != 0 )
+		return 0;
+
+	while( q->ItemsAvailable == 0 )
+		{
+		if( TimeToWait == 0 )
+			{
+			Unlock( q );
+			return 0;
+			}
+
+		Sequence	= q->ReadSequence;
+		q->ReadersWaiting++;
+		Unlock( q );
+
+		Result		= FutexWait( &q->ReadSequence, Sequence, TimeToWait < 0 ? NULL : &DeadLine );
+
+		if( Lock( q ) != 0 )
+			return 0;
+		q->ReadersWaiting--;
+
+		if( Result == ETIMEDOUT && q->ItemsAvailable == 0 )
+			{
+			Unlock( q );
+			return 0;
+			}
+		}
+
+	RemoveIndex	= q->RemoveIndex;
+	ItemLength	= ReadItemHeader( q, &RemoveIndex );
+
+	if( BufferSize < ItemLength )
+		{
+		/* Let some other reader with a larger buffer have a go at this item. */
+		q->ReadSequence++;
+		if( q->ReadersWaiting != 0 )
+			FutexWake( &q->ReadSequence, INT_MAX );
+		Unlock( q );
+		return -1;
+		}
+
+	/*
+	 The copy is done with the lock held, so a reader that dies in the middle of
+	 it leaves the item in the queue instead of a dangling reservation.
+	*/
+	RemainingBytes	= ItemLength;
+	while(( Aux = min( RemainingBytes, q->QueueLength - RemoveIndex ) ) > 0 )
+		{
+		memcpy( Ptr, &q->QueueBuffer[ RemoveIndex ], Aux );
+		Ptr	= (char*)Ptr + Aux;
+		if(( RemoveIndex += Aux ) >= q->QueueLength )
+			RemoveIndex	= 0;
+		RemainingBytes	-= Aux;
+		}
+
+	q->RemoveIndex	= RemoveIndex;
+
+	q->ItemsAvailable--;
+	q->BytesFree	+= EffectiveSize( ItemLength );
+
+	/*------------------------------------------------------------------------*/
+	/*
+	 We don't know the sizes of the items the writers are waiting to insert, so
+	 all of them are awaken to check whether theirs fit now.
+	*/
+	/*------------------------------------------------------------------------*/
+	q->WriteSequence++;
+	if( q->WritersWaiting != 0 )
+		FutexWake( &q->WriteSequence, INT_MAX );
+
+	Unlock( q );
+
+	return ItemLength;
+	}
+/*============================================================================*/
+int xShmFlexiQueueWrite( shmflexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize, long TimeToWait )
+	{
+	shmflexiqueue_hdr_t	*q;
+	struct timespec		DeadLine;
+	unsigned int		InsertIndex, Aux, RemainingBytes, Sequence;
+	int					Result;
+
+	if( Queue == NULL || ItemSize == 0 )
+		return 0;
+
+	q	= Queue->Header;
+
+	if( EffectiveSize( ItemSize ) > q->QueueLength || ItemSize > 0x8000 )
+		return -1;
+
+	if( TimeToWait > 0 )
+		GetDeadLine( &DeadLine, TimeToWait );
+
+	if( Lock( q ) != 0 )
+		return 0;
+
+	while( EffectiveSize( ItemSize ) > q->BytesFree )
+		{
+		if( TimeToWait == 0 )
+			{
+			Unlock( q );
+			return 0;
+			}
+
+		Sequence	= q->WriteSequence;
+		q->WritersWaiting++;
+		Unlock( q );
+
+		Result		= FutexWait( &q->WriteSequence, Sequence, TimeToWait < 0 ? NULL : &DeadLine );
+
+		if( Lock( q ) != 0 )
+			return 0;
+		q->WritersWaiting--;
+
+		if( Result == ETIMEDOUT && EffectiveSize( ItemSize ) > q->BytesFree )
+			{
+			Unlock( q );
+			return 0;
+			}
+		}
+
+	Aux			= ItemSize - 1;
+	InsertIndex	= q->InsertIndex;
+	q->QueueBuffer[ InsertIndex ]	= ItemSize > 128 ? (unsigned char)( Aux | 0x80 ) : (unsigned char)( Aux & 0x7f );
+	if( ++InsertIndex >= q->QueueLength )
+		InsertIndex	= 0;
+	if( ItemSize > 128 )
+		{
+		q->QueueBuffer[ InsertIndex ]	= (unsigned char)( Aux >> 7 );
+		if( ++InsertIndex >= q->QueueLength )
+			InsertIndex	= 0;
+		}
+
+	RemainingBytes	= ItemSize;
+	while(( Aux = min( RemainingBytes, q->QueueLength - InsertIndex ) ) > 0 )
+		{
+		memcpy( &q->QueueBuffer[ InsertIndex ], Ptr, Aux );
+		Ptr	= (const char*)Ptr + Aux;
+		if(( InsertIndex += Aux ) >= q->QueueLength )
+			InsertIndex	= 0;
+		RemainingBytes	-= Aux;
+		}
+
+	q->InsertIndex	= InsertIndex;
+
+	q->ItemsAvailable++;
+	q->BytesFree	-= EffectiveSize( ItemSize );
+
+	/*
+	 All the readers are woken, not just one: a reader woken alone could die
+	 before taking the lock and swallow the wake-up, leaving the others asleep
+	 next to the item. The ones that lose the race go back to sleep.
+	*/
+	q->ReadSequence++;
+	if( q->ReadersWaiting != 0 )
+		FutexWake( &q->ReadSequence, INT_MAX );
+
+	Unlock( q );
+
+	return 1;
+	}
+/*============================================================================*/
+int xShmFlexiQueueFlush( shmflexiqueue_t *Queue )
+	{
+	shmflexiqueue_hdr_t	*q;
+
+	if( Queue == NULL )
+		return 0;
+
+	q	= Queue->Header;
+
+	if( Lock( q ) != 0 )
+		return 0;
+
+	ResetQueue( q );
+
+	q->WriteSequence++;
+	if( q->WritersWaiting != 0 )
+		FutexWake( &q->WriteSequence, INT_MAX );
+
+	Unlock( q );
+
+	return 1;
+	}
+/*============================================================================*/
+unsigned int xShmFlexiQueueRecoveries( shmflexiqueue_t *Queue )
+	{
+	return Queue == NULL ? 0 : __atomic_load_n( &Queue->Header->Recoveries, __ATOMIC_RELAXED );
+	}
+/*============================================================================*/
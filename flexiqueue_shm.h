@@ -0,0 +1,97 @@
+/*============================================================================*/
+/*
+ Copyright (c) 2007-2014, Isaac Marino Bavaresco
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of the author nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE AUTHOR ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*============================================================================*/
+/*
+ Host-side (Linux) FlexiQueue whose control block and ring live in a POSIX
+ shared-memory object, so separate processes of the simulator can exchange
+ variable-length items without serializing them through pipes.
+
+ The items are stored with exactly the same length header as in flexiqueue.c.
+ Blocking is done with futexes and the control block is protected by a robust
+ process-shared mutex, so a peer that dies while holding it does not hang the
+ other processes (see xShmFlexiQueueRecoveries).
+
+ Time-outs are given in milliseconds, a negative value means "wait forever".
+*/
+/*============================================================================*/
+#if         !defined __FLEXIQUEUE_SHM_H__
+#define __FLEXIQUEUE_SHM_H__
+/*============================================================================*/
+#include <stddef.h>
+#include <pthread.h>
+/*============================================================================*/
+
+#define SHM_QUEUE_MAGIC             0x46517368u     /* "FQsh" */
+#define SHM_QUEUE_VERSION           1
+
+/*============================================================================*/
+
+/* Control block, placed at the start of the shared-memory object. */
+typedef struct
+    {
+    unsigned int    Magic;
+    unsigned int    Version;
+    pthread_mutex_t Lock;
+    unsigned int    QueueLength;
+    unsigned int    BytesFree;
+    unsigned int    ItemsAvailable;
+    unsigned int    RemoveIndex;
+    unsigned int    InsertIndex;
+    /* Futex words, incremented (wrapping) each time items are inserted or bytes freed. */
+    volatile unsigned int   ReadSequence;
+    volatile unsigned int   WriteSequence;
+    /*
+     Hints only, used to avoid the wake-up system call when nobody is waiting.
+     A peer killed while waiting leaves its count behind, which costs nothing
+     but a wake-up call nobody needed; they must never be trusted to be exact.
+    */
+    unsigned int    ReadersWaiting;
+    unsigned int    WritersWaiting;
+    /* Number of times the queue was recovered after a peer died holding the lock. */
+    unsigned int    Recoveries;
+    unsigned char   QueueBuffer[];
+    } shmflexiqueue_hdr_t;
+
+/* Per-process handle. */
+typedef struct
+    {
+    shmflexiqueue_hdr_t *Header;
+    size_t              MapSize;
+    } shmflexiqueue_t;
+
+/*============================================================================*/
+
+shmflexiqueue_t *xShmFlexiQueueCreate       ( const char *Name, unsigned int QueueLength );
+shmflexiqueue_t *xShmFlexiQueueOpen         ( const char *Name );
+void            vShmFlexiQueueClose         ( shmflexiqueue_t *Queue );
+int             xShmFlexiQueueUnlink        ( const char *Name );
+int             xShmFlexiQueueRead          ( shmflexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, long TimeToWait );
+int             xShmFlexiQueueWrite         ( shmflexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize, long TimeToWait );
+int             xShmFlexiQueueFlush         ( shmflexiqueue_t *Queue );
+unsigned int    xShmFlexiQueueRecoveries    ( shmflexiqueue_t *Queue );
+
+/*============================================================================*/
+#endif  /*  !defined __FLEXIQUEUE_SHM_H__ */
+/*============================================================================*/
@@ -0,0 +1,798 @@
+/*============================================================================*/
+/*
+SimpleRTOS - Very simple RTOS for Microcontrollers
+v2.00 (2014-01-21)
+isaacbavaresco@yahoo.com.br
+*/
+/*============================================================================*/
+/*
+ Copyright (c) 2007-2014, Isaac Marino Bavaresco
+ All rights reserved.
+
+ Redistribution and use in source and binary forms, with or without
+ modification, are permitted provided that the following conditions are met:
+     * Redistributions of source code must retain the above copyright
+       notice, this list of conditions and the following disclaimer.
+     * Neither the name of the author nor the
+       names of its contributors may be used to endorse or promote products
+       derived from this software without specific prior written permission.
+
+ THIS SOFTWARE IS PROVIDED BY THE AUTHOR ''AS IS'' AND ANY
+ EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ DISCLAIMED. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY
+ DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+ (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+ LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+/*============================================================================*/
+/*
+ SMP build of the FlexiQueue, selected by defining QUEUE_SMP (flexiqueue.c
+ then compiles to nothing).
+
+ Each queue has its own spinlock, held only while the counters and indices are
+ updated. The payload is copied with the lock released: a writer first reserves
+ its bytes (WriteReserved) and a reader claims the item at RemoveIndex
+ (ReadBusy), so one reader and one writer can copy at the same time on
+ different cores. Writers are serialized among themselves, and so are readers,
+ because the items must be committed in the same order they were reserved.
+
+ A task that has to wait is woken only to be handed the read side or its
+ reserved bytes, by the reader or writer that made them available, so it never
+ has to race newcomers for them and go back to the end of the line.
+
+ The event lists still belong to the kernel and are only touched inside
+ taskENTER_CRITICAL, which is always entered before the queue's spinlock.
+ xTaskRemoveFromEventList takes care of interrupting the other core when the
+ woken task must preempt the task running there.
+
+ A task holding the read side or reserved room would block the other readers
+ or writers, higher-priority ones and ISRs included, for as long as it stays
+ preempted. With configUSE_TASK_PREEMPTION_DISABLE set to 1 the task paths
+ disable their own preemption from the claim to the commit, so the hold lasts
+ no longer than the copy. Without it, a preempted low-priority task keeps its
+ side until it runs again and the FromISR calls find the queue busy (return 0)
+ meanwhile. A task that was handed a side while blocked holds it from the
+ moment it is woken, until it is scheduled.
+*/
+/*============================================================================*/
+#include <string.h>
+#include "FreeRTOS.h"
+#include "list.h"
+#include "task.h"
+/*============================================================================*/
+#include "flexiqueue.h"
+#include "addontrace.h"
+/*============================================================================*/
+#if			defined QUEUE_SMP
+/*============================================================================*/
+#if			defined QUEUE_STRICT_CHRONOLOGY
+#error "QUEUE_STRICT_CHRONOLOGY is not supported by the SMP build of the FlexiQueue"
+#endif	/*	defined QUEUE_STRICT_CHRONOLOGY */
+/*============================================================================*/
+#if			defined configUSE_TASK_PREEMPTION_DISABLE && configUSE_TASK_PREEMPTION_DISABLE == 1
+#define	QUEUE_PREEMPTION_DISABLE()	vTaskPreemptionDisable( NULL )
+#define	QUEUE_PREEMPTION_ENABLE()	vTaskPreemptionEnable( NULL )
+#else	/*	defined configUSE_TASK_PREEMPTION_DISABLE && configUSE_TASK_PREEMPTION_DISABLE == 1 */
+#define	QUEUE_PREEMPTION_DISABLE()
+#define	QUEUE_PREEMPTION_ENABLE()
+#endif	/*	defined configUSE_TASK_PREEMPTION_DISABLE && configUSE_TASK_PREEMPTION_DISABLE == 1 */
+/*============================================================================*/
+flexiqueue_t *xFlexiQueueCreate( unsigned int QueueLength, int Mode )
+	{
+	flexiqueue_t	*Queue;
+	char			*QueueBuffer;
+
+	Queue		= pvPortMalloc( sizeof( flexiqueue_t ));
+	if( Queue == NULL )
+		return NULL;
+
+	QueueBuffer	= pvPortMalloc( QueueLength );
+	if( QueueBuffer == NULL )
+		{
+		vPortFree( Queue );
+		return NULL;
+		}
+
+	vListInitialise( &( Queue->TasksWaitingToWrite ) );
+	vListInitialise( &( Queue->TasksWaitingToRead ) );
+	Queue->QueueLength			= QueueLength;
+	Queue->BytesFree			= QueueLength;
+	Queue->QueueBuffer			= (unsigned char*)QueueBuffer;
+	Queue->ItemsAvailable		= 0;
+	Queue->RemoveIndex			= 0;
+	Queue->InsertIndex			= 0;
+	Queue->Mode					= Mode;
+	Queue->Lock					= spinlockINIT;
+	Queue->WriteReserved		= 0;
+	Queue->ReadBusy				= 0;
+	Queue->FlushPending			= 0;
+	Queue->FlushIndex			= 0;
+	Queue->FlushItems			= 0;
+	Queue->FlushBytes			= 0;
+	Queue->ReadersWaiting		= 0;
+	Queue->WritersWaiting		= 0;
+
+	return Queue;
+	}
+/*============================================================================*/
+static inline __attribute((always_inline)) unsigned int EffectiveSize( unsigned int s )
+	{
+	return s + ( s > 128 ? 2 : 1 );
+	}
+/*============================================================================*/
+/*
+ A blocked task's extra parameter holds its buffer or item size; the task that
+ wakes it replaces it with one of these markers. A task that finds the parameter
+ unchanged after waking up has timed out.
+*/
+/*============================================================================*/
+#define	WAIT_GRANTED	((void*)~0ul)
+#define	WAIT_FLUSHED	((void*)~1ul)
+/*============================================================================*/
+/* Must be called with the queue's lock held. */
+/*============================================================================*/
+static inline __attribute((always_inline)) int ClaimRead( flexiqueue_t *q )
+	{
+	if( q->ItemsAvailable == 0 || q->ReadBusy )
+		return 0;
+
+	q->ReadBusy	= 1;
+	return 1;
+	}
+/*============================================================================*/
+/* Must be called with the queue's lock held. */
+/*============================================================================*/
+static inline __attribute((always_inline)) int ReserveWrite( flexiqueue_t *q, unsigned int ItemSize )
+	{
+	if( q->WriteReserved != 0 || EffectiveSize( ItemSize ) > q->BytesFree )
+		return 0;
+
+	q->BytesFree	   -= EffectiveSize( ItemSize );
+	q->WriteReserved	= EffectiveSize( ItemSize );
+	return 1;
+	}
+/*============================================================================*/
+/*
+ Marks the items committed so far as flushed. InsertIndex only moves on commit,
+ so the write being copied, and any committed after this, are kept. Must be
+ called with the queue's lock held.
+*/
+/*============================================================================*/
+static void MarkFlushed( flexiqueue_t *q )
+	{
+	q->FlushIndex	= q->InsertIndex;
+	q->FlushItems	= q->ItemsAvailable;
+	q->FlushBytes	= q->QueueLength - q->BytesFree - q->WriteReserved;
+	q->FlushPending	= 1;
+	}
+/*============================================================================*/
+/* Must be called with the queue's lock held and no read in progress. */
+/*============================================================================*/
+static void DiscardFlushed( flexiqueue_t *q )
+	{
+	q->RemoveIndex		= q->FlushIndex;
+	q->ItemsAvailable  -= q->FlushItems;
+	q->BytesFree	   += q->FlushBytes;
+	q->FlushPending		= 0;
+	}
+/*============================================================================*/
+static unsigned int ReadItemHeader( flexiqueue_t *q, unsigned int *Index )
+	{
+	unsigned int	RemoveIndex, ItemLength;
+
+	RemoveIndex	= *Index;
+	ItemLength	= (unsigned short)q->QueueBuffer[ RemoveIndex ];
+	if( ++RemoveIndex >= q->QueueLength )
+		RemoveIndex	= 0;
+	if( ItemLength > 127 )
+		{
+		ItemLength	= ( ItemLength & 0x7f ) | ( (unsigned short)q->QueueBuffer[ RemoveIndex ] << 7 );
+		if( ++RemoveIndex >= q->QueueLength )
+			RemoveIndex	= 0;
+		}
+	*Index	= RemoveIndex;
+	return ItemLength + 1;
+	}
+/*============================================================================*/
+static unsigned int CopyFromQueue( flexiqueue_t *q, void *Ptr, unsigned int RemoveIndex, unsigned int ItemLength )
+	{
+	unsigned int	Aux, RemainingBytes;
+
+	RemainingBytes	= ItemLength;
+	while(( Aux = min( RemainingBytes, q->QueueLength - RemoveIndex ) ) > 0 )
+		{
+		memcpy( (void*)Ptr, (void*)&q->QueueBuffer[ RemoveIndex ], Aux );
+		Ptr	= (char*)Ptr + Aux;
+		if(( RemoveIndex += Aux ) >= q->QueueLength )
+			RemoveIndex	= 0;
+		RemainingBytes	-= Aux;
+		}
+
+	return RemoveIndex;
+	}
+/*============================================================================*/
+/* Writes the length header and, unless Ptr is NULL (the item is already in place), the item. */
+/*============================================================================*/
+static unsigned int CopyToQueue( flexiqueue_t *q, const void *Ptr, unsigned int InsertIndex, unsigned int ItemSize )
+	{
+	unsigned int	Aux, RemainingBytes;
+
+	Aux			= ItemSize - 1;
+	q->QueueBuffer[ InsertIndex ]	= ItemSize > 128 ? (unsigned char)( Aux | 0x80 ) : (unsigned char)( Aux & 0x7f );
+	if( ++InsertIndex >= q->QueueLength )
+		InsertIndex	= 0;
+	if( ItemSize > 128 )
+		{
+		q->QueueBuffer[ InsertIndex ]	= (unsigned char)( Aux >> 7 );
+		if( ++InsertIndex >= q->QueueLength )
+			InsertIndex	= 0;
+		}
+
+	if( Ptr == NULL )
+		{
+		if(( InsertIndex += ItemSize ) >= q->QueueLength )
+			InsertIndex	-= q->QueueLength;
+		return InsertIndex;
+		}
+
+	RemainingBytes	= ItemSize;
+	while(( Aux = min( RemainingBytes, q->QueueLength - InsertIndex ) ) > 0 )
+		{
+		memcpy( (void*)&q->QueueBuffer[ InsertIndex ], (void*)Ptr, Aux );
+		Ptr	= (const char*)Ptr + Aux;
+		if(( InsertIndex += Aux ) >= q->QueueLength )
+			InsertIndex	= 0;
+		RemainingBytes	-= Aux;
+		}
+
+	return InsertIndex;
+	}
+/*============================================================================*/
+/*
+ Hands the read side to the reader at the head of the list and reserves room
+ for the writer at the head of the list, when they are free. Must be called
+ inside a critical section, FromISR tells whether it is an ISR's. Returns
+ non-zero if a woken task has higher priority than the current one.
+*/
+/*============================================================================*/
+static int Grant( flexiqueue_t *Queue, int Readers, int Writers, int FromISR )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	xTaskHandle				r = NULL, w = NULL;
+	unsigned int			Size = 0;
+	int						Woken = 0;
+
+	if( Readers && !listLIST_IS_EMPTY( &Queue->TasksWaitingToRead ))
+		r		= (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToRead );
+	if( Writers && !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
+		{
+		w		= (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToWrite );
+		Size	= (unsigned int)pvGetExtraParameter( w );
+		}
+
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	if( r != NULL && !ClaimRead( Queue ))
+		r	= NULL;
+	if( w != NULL && !ReserveWrite( Queue, Size ))
+		w	= NULL;
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( r != NULL )
+		{
+		vSetExtraParameter( r, WAIT_GRANTED );
+		traceADDON_TASK( addontraceFQ_HANDOFF_READ, Queue, r, 0 );
+
+		if( FromISR )
+			{
+			traceADDON_ISR( addontraceFQ_WAKE_READER, Queue, 0 );
+			}
+		else
+			{
+			traceADDON( addontraceFQ_WAKE_READER, Queue, 0 );
+			}
+		if( xTaskRemoveFromEventList( &Queue->TasksWaitingToRead ) == pdTRUE )
+			Woken	= 1;
+		}
+	if( w != NULL )
+		{
+		vSetExtraParameter( w, WAIT_GRANTED );
+		traceADDON_TASK( addontraceFQ_HANDOFF_WRITE, Queue, w, 0 );
+
+		if( FromISR )
+			{
+			traceADDON_ISR( addontraceFQ_WAKE_WRITER, Queue, 0 );
+			}
+		else
+			{
+			traceADDON( addontraceFQ_WAKE_WRITER, Queue, 0 );
+			}
+		if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE )
+			Woken	= 1;
+		}
+
+	return Woken;
+	}
+/*============================================================================*/
+/*
+ Claims the read side or reserves room for ItemSize bytes, waiting for them if
+ needed. Returns 1 on success and 0 on timeout or flush.
+
+ The claim is retried with the kernel lock held, so a task on another core that
+ commits between our first try and our going to sleep will find us in the list
+ when it looks for tasks to hand the queue to. A task already in line has
+ precedence over us. Once in the list we stay in our place until we are granted
+ what we wait for or TimeToWait, handed to the kernel as is, expires.
+ portMAX_DELAY waits forever; if the kernel can't block indefinitely
+ (INCLUDE_vTaskSuspend == 0) the wait is simply renewed when it expires.
+*/
+/*============================================================================*/
+static int Wait( flexiqueue_t *Queue, int Reading, unsigned int Size, portTickType TimeToWait )
+	{
+	xTaskHandle				Self	= xTaskGetCurrentTaskHandle();
+	xList					*List	= Reading ? &Queue->TasksWaitingToRead : &Queue->TasksWaitingToWrite;
+	unsigned short			*Waiting= Reading ? &Queue->ReadersWaiting : &Queue->WritersWaiting;
+	unsigned portBASE_TYPE	uxSavedMask;
+	void					*Result;
+	int						Owner, Woken = 0;
+
+	taskENTER_CRITICAL();
+
+	for( ;; )
+		{
+		uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+		if(( Owner = listLIST_IS_EMPTY( List ) && ( Reading ? ClaimRead( Queue ) : ReserveWrite( Queue, Size ))) == 0 )
+			(*Waiting)++;
+		vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+		if( Owner )
+			break;
+
+		vSetExtraParameter( Self, (void*)Size );
+		traceADDON( Reading ? addontraceFQ_BLOCK_READ : addontraceFQ_BLOCK_WRITE, Queue, TimeToWait );
+		vTaskPlaceOnEventList( List, TimeToWait );
+
+		taskEXIT_CRITICAL();
+		taskYIELD();
+		taskENTER_CRITICAL();
+
+		Result	= pvGetExtraParameter( Self );
+
+		uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+		(*Waiting)--;
+		vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+		if( Result != (void*)Size || TimeToWait != portMAX_DELAY )
+			{
+			Owner	= Result == WAIT_GRANTED;
+			break;
+			}
+		}
+
+	/* A writer that gave up may have been holding back the ones behind it. */
+	if( !Owner && !Reading )
+		Woken	= Grant( Queue, 0, 1, 0 );
+
+	taskEXIT_CRITICAL();
+
+	if( Woken && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		taskYIELD();
+
+	return Owner;
+	}
+/*============================================================================*/
+static int Wake( flexiqueue_t *Queue, int Readers, int Writers )
+	{
+	int	Woken;
+
+	if( !Readers && !Writers )
+		return 0;
+
+	taskENTER_CRITICAL();
+	Woken	= Grant( Queue, Readers, Writers, 0 );
+	taskEXIT_CRITICAL();
+
+	return Woken && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE );
+	}
+/*============================================================================*/
+static int WakeFromISR( flexiqueue_t *Queue, int Readers, int Writers )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	int						Woken;
+
+	if( !Readers && !Writers )
+		return 0;
+
+	uxSavedMask	= taskENTER_CRITICAL_FROM_ISR();
+	Woken	= Grant( Queue, Readers, Writers, 1 );
+	taskEXIT_CRITICAL_FROM_ISR( uxSavedMask );
+
+	return Woken;
+	}
+/*============================================================================*/
+/*
+ Reads the item at RemoveIndex, the caller owns the read side (ReadBusy). The
+ read side is released before returning and handed on if anybody waits for it.
+ FromISR tells whether the caller is an ISR.
+*/
+/*============================================================================*/
+static int ReadItem( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, int *WakeReader, int *WakeWriter, int FromISR )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	unsigned int			RemoveIndex, ItemLength;
+	int						Result;
+
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+
+	/* A flush may have come while the read side was being handed to us, items written after it are still ours. */
+	if( Queue->FlushPending )
+		DiscardFlushed( Queue );
+
+	if( Queue->ItemsAvailable == 0 )
+		Result	= 0;
+	else
+		{
+		RemoveIndex	= Queue->RemoveIndex;
+		ItemLength	= ReadItemHeader( Queue, &RemoveIndex );
+		Result		= BufferSize < ItemLength ? -1 : (int)ItemLength;
+		}
+
+	if( Result > 0 )
+		{
+		vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+		RemoveIndex	= CopyFromQueue( Queue, Ptr, RemoveIndex, ItemLength );
+
+		uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+		Queue->ItemsAvailable--;
+		Queue->RemoveIndex	= RemoveIndex;
+		Queue->BytesFree   += EffectiveSize( ItemLength );
+		/* A flush during the copy counted our item among the ones to discard. */
+		if( Queue->FlushPending )
+			{
+			Queue->FlushItems--;
+			Queue->FlushBytes  -= EffectiveSize( ItemLength );
+			}
+		}
+
+	Queue->ReadBusy	= 0;
+	if( Queue->FlushPending )
+		DiscardFlushed( Queue );
+	*WakeReader	= Queue->ReadersWaiting != 0 && Queue->ItemsAvailable != 0;
+	*WakeWriter	= Queue->WritersWaiting != 0 && Result != -1;
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( Result > 0 && FromISR )
+		{
+		traceADDON_ISR( addontraceFQ_DEQUEUE, Queue, Result );
+		}
+	else if( Result > 0 )
+		{
+		traceADDON( addontraceFQ_DEQUEUE, Queue, Result );
+		}
+
+	return Result;
+	}
+/*============================================================================*/
+/*
+ Writes the item into the room reserved for it (WriteReserved) and commits it.
+ A NULL Ptr commits an item already written in place. FromISR is as for
+ ReadItem.
+*/
+/*============================================================================*/
+static void WriteItem( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize, int *WakeReader, int *WakeWriter, int FromISR )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	unsigned int			InsertIndex;
+
+	InsertIndex	= CopyToQueue( Queue, Ptr, Queue->InsertIndex, ItemSize );
+
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	Queue->InsertIndex		= InsertIndex;
+	Queue->ItemsAvailable++;
+	Queue->WriteReserved	= 0;
+	*WakeReader	= Queue->ReadersWaiting != 0;
+	*WakeWriter	= Queue->WritersWaiting != 0;
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( FromISR )
+		{
+		traceADDON_ISR( addontraceFQ_ENQUEUE, Queue, ItemSize );
+		}
+	else
+		{
+		traceADDON( addontraceFQ_ENQUEUE, Queue, ItemSize );
+		}
+	}
+/*============================================================================*/
+int xFlexiQueueRead( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize, portTickType TimeToWait )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	int						Owner, Result, WakeReader, WakeWriter;
+
+	if( Queue == NULL )
+		return 0;
+
+	QUEUE_PREEMPTION_DISABLE();
+
+	/* Don't jump ahead of the readers already waiting. */
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	Owner	= Queue->ReadersWaiting == 0 && ClaimRead( Queue );
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( !Owner )
+		{
+		QUEUE_PREEMPTION_ENABLE();
+		if( TimeToWait == 0 )
+			return 0;
+		if( !Wait( Queue, 1, min( BufferSize, Queue->QueueLength ), TimeToWait ))
+			{
+			traceADDON( addontraceFQ_TIMEOUT_READ, Queue, 0 );
+			return 0;
+			}
+		QUEUE_PREEMPTION_DISABLE();
+		}
+
+	Result	= ReadItem( Queue, Ptr, BufferSize, &WakeReader, &WakeWriter, 0 );
+
+	QUEUE_PREEMPTION_ENABLE();
+
+	/*------------------------------------------------------------------------*/
+	/*
+	 We removed some bytes from the buffer, there should be room for more items
+	 in the queue. The next reader in line may have the next item, or the one
+	 our buffer couldn't take.
+	*/
+	/*------------------------------------------------------------------------*/
+	if( Wake( Queue, WakeReader, WakeWriter ))
+		taskYIELD();
+
+	return Result;
+	}
+/*============================================================================*/
+int xFlexiQueueReadFromISR( flexiqueue_t *Queue, void *Ptr, unsigned int BufferSize )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	int						Owner, Result, WakeReader, WakeWriter;
+
+	if( Queue == NULL )
+		return 0;
+
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	Owner	= Queue->ReadersWaiting == 0 && ClaimRead( Queue );
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( !Owner )
+		return 0;
+
+	Result	= ReadItem( Queue, Ptr, BufferSize, &WakeReader, &WakeWriter, 1 );
+
+	/* A task on another core may have blocked on the read side while we held it. */
+	if( WakeFromISR( Queue, WakeReader, WakeWriter ) && Result > 0 )
+		return Result | 0x40000000;
+
+	return Result;
+	}
+/*============================================================================*/
+int xFlexiQueueWrite( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize, portTickType TimeToWait )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	int						Owner, WakeReader, WakeWriter;
+
+	if( Queue == NULL )
+		return 0;
+
+	if( EffectiveSize( ItemSize ) > Queue->QueueLength )
+		return -1;
+
+	QUEUE_PREEMPTION_DISABLE();
+
+	/* Don't jump ahead of the writers already waiting for room. */
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	Owner	= Queue->WritersWaiting == 0 && ReserveWrite( Queue, ItemSize );
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( !Owner )
+		{
+		QUEUE_PREEMPTION_ENABLE();
+		if( TimeToWait == 0 )
+			return 0;
+		if( !Wait( Queue, 0, ItemSize, TimeToWait ))
+			{
+			traceADDON( addontraceFQ_TIMEOUT_WRITE, Queue, 0 );
+			return 0;
+			}
+		QUEUE_PREEMPTION_DISABLE();
+		}
+
+	WriteItem( Queue, Ptr, ItemSize, &WakeReader, &WakeWriter, 0 );
+
+	QUEUE_PREEMPTION_ENABLE();
+
+	/*------------------------------------------------------------------------*/
+	/*
+	 We inserted some bytes into the buffer, let's hand them to the reader at the
+	 head of the list. The write side is free again for the next writer in line.
+	*/
+	/*------------------------------------------------------------------------*/
+	if( Wake( Queue, WakeReader, WakeWriter ))
+		taskYIELD();
+
+	return 1;
+	}
+/*============================================================================*/
+int xFlexiQueueWriteFromISR( flexiqueue_t *Queue, const void *Ptr, unsigned int ItemSize )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	int						Owner, WakeReader, WakeWriter;
+
+	if( Queue == NULL )
+		return 0;
+
+	if( EffectiveSize( ItemSize ) > Queue->QueueLength )
+		return -1;
+
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	Owner	= Queue->WritersWaiting == 0 && ReserveWrite( Queue, ItemSize );
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( !Owner )
+		return 0;
+
+	WriteItem( Queue, Ptr, ItemSize, &WakeReader, &WakeWriter, 1 );
+
+	/* A task on another core may have blocked on the write side while we held it. */
+	if( WakeFromISR( Queue, WakeReader, WakeWriter ) && ( Queue->Mode & QUEUE_SWITCH_IN_ISR ))
+		return 2;
+
+	return 1;
+	}
+/*============================================================================*/
+/* Points Reservation to the room after the length header at InsertIndex. */
+/*============================================================================*/
+static void FillReservation( flexiqueue_t *Queue, flexiqueue_reservation_t *Reservation, unsigned int ItemSize )
+	{
+	unsigned int	Index;
+
+	Index	= Queue->InsertIndex + ( ItemSize > 128 ? 2 : 1 );
+	if( Index >= Queue->QueueLength )
+		Index  -= Queue->QueueLength;
+
+	Reservation->Data[0]	= &Queue->QueueBuffer[ Index ];
+	Reservation->Length[0]	= min( ItemSize, Queue->QueueLength - Index );
+	Reservation->Data[1]	= Queue->QueueBuffer;
+	Reservation->Length[1]	= ItemSize - Reservation->Length[0];
+	}
+/*============================================================================*/
+/*
+ The reservation is the write side held across calls, so unlike xFlexiQueueWrite
+ we leave preemption enabled: the item is filled in by the caller's code.
+*/
+/*============================================================================*/
+int xFlexiQueueReserve( flexiqueue_t *Queue, flexiqueue_reservation_t *Reservation, unsigned int ItemSize, portTickType TimeToWait )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	int						Owner;
+
+	if( Queue == NULL )
+		return 0;
+
+	if( EffectiveSize( ItemSize ) > Queue->QueueLength )
+		return -1;
+
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	Owner	= Queue->WritersWaiting == 0 && ReserveWrite( Queue, ItemSize );
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( !Owner )
+		{
+		if( TimeToWait == 0 )
+			return 0;
+		if( !Wait( Queue, 0, ItemSize, TimeToWait ))
+			{
+			traceADDON( addontraceFQ_TIMEOUT_WRITE, Queue, 0 );
+			return 0;
+			}
+		}
+
+	FillReservation( Queue, Reservation, ItemSize );
+	return 1;
+	}
+/*============================================================================*/
+int xFlexiQueueCommit( flexiqueue_t *Queue )
+	{
+	unsigned int	Reserved;
+	int				WakeReader, WakeWriter;
+
+	if( Queue == NULL || ( Reserved = Queue->WriteReserved ) == 0 )
+		return 0;
+
+	WriteItem( Queue, NULL, Reserved - ( Reserved > 129 ? 2 : 1 ), &WakeReader, &WakeWriter, 0 );
+
+	if( Wake( Queue, WakeReader, WakeWriter ))
+		taskYIELD();
+
+	return 1;
+	}
+/*============================================================================*/
+int xFlexiQueueCancel( flexiqueue_t *Queue )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	int						WakeWriter;
+
+	if( Queue == NULL || Queue->WriteReserved == 0 )
+		return 0;
+
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	Queue->BytesFree	   += Queue->WriteReserved;
+	Queue->WriteReserved	= 0;
+	WakeWriter	= Queue->WritersWaiting != 0;
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	if( Wake( Queue, 0, WakeWriter ))
+		taskYIELD();
+
+	return 1;
+	}
+/*============================================================================*/
+int xFlexiQueueFlush( flexiqueue_t *Queue, int Flag )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	int						MustYield	= 0;
+	int						f = 0;
+
+	if( Queue == NULL )
+		return 0;
+
+	traceADDON( addontraceFQ_FLUSH, Queue, Flag );
+
+	/*
+	 The item of a reader that owns the read side is left to it, it finishes the
+	 flush, discarding only what was committed up to now.
+	*/
+	uxSavedMask	= uxSpinLockAcquire( &Queue->Lock );
+	MarkFlushed( Queue );
+	if( !Queue->ReadBusy )
+		DiscardFlushed( Queue );
+	vSpinLockRelease( &Queue->Lock, uxSavedMask );
+
+	taskENTER_CRITICAL();
+
+	if( Flag & QUEUE_FLUSH_READING_TASKS )
+		while( !listLIST_IS_EMPTY( &Queue->TasksWaitingToRead ))
+			{
+			f	|= QUEUE_FLUSH_READING_TASKS;
+			vSetExtraParameter( (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToRead ), WAIT_FLUSHED );
+			traceADDON( addontraceFQ_WAKE_READER, Queue, 0 );
+			if( xTaskRemoveFromEventList( &Queue->TasksWaitingToRead ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+				MustYield	= 1;
+			}
+
+	if( Flag & QUEUE_FLUSH_WRITING_TASKS )
+		{
+		while( !listLIST_IS_EMPTY( &Queue->TasksWaitingToWrite ))
+			{
+			f	|= QUEUE_FLUSH_WRITING_TASKS;
+			vSetExtraParameter( (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( &Queue->TasksWaitingToWrite ), WAIT_FLUSHED );
+			traceADDON( addontraceFQ_WAKE_WRITER, Queue, 0 );
+			if( xTaskRemoveFromEventList( &Queue->TasksWaitingToWrite ) == pdTRUE && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+				MustYield	= 1;
+			}
+		}
+	/* The buffer is empty now, let the first writer in. */
+	else if( Grant( Queue, 0, 1, 0 ) && ( Queue->Mode & QUEUE_SWITCH_IMMEDIATE ))
+		MustYield	= 1;
+
+	taskEXIT_CRITICAL();
+
+	if( MustYield )
+		taskYIELD();
+
+	return f;
+	}
+/*============================================================================*/
+#endif	/*	defined QUEUE_SMP */
+/*============================================================================*/
@@ -6,6 +6,9 @@
 #include "FreeRTOS.h"
 #include "list.h"
 #include "task.h"
+#include "addontrace.h"
+//==============================================================================
+#if			!defined MUTEX_SMP
 //==============================================================================
 typedef struct
 {
@@ -37,23 +40,27 @@ signed portBASE_TYPE xMutexTake( xMutexHandle pxMutex, portTickType xTicksToWait
 	if( pxMutex->pxOwner == xTaskGetCurrentTaskHandle() )
 		{
 		pxMutex->uxCount++;
+		traceADDON( addontraceMUTEX_TAKE, pxMutex, pxMutex->uxCount );
 		portEXIT_CRITICAL();
 		return pdTRUE;
 		}
 
 	if(( xTicksToWait > ( portTickType ) 0 ) && ( pxMutex->pxOwner != NULL ))
 		{
+		traceADDON( addontraceMUTEX_CONTEND, pxMutex, xTicksToWait );
 		vTaskPlaceOnEventList( &( pxMutex->xTasksWaitingToTake ), xTicksToWait );
 		taskYIELD();
 
 		if( pxMutex->pxOwner == xTaskGetCurrentTaskHandle() )
 			{
 			pxMutex->uxCount = 1;
+			traceADDON( addontraceMUTEX_TAKE, pxMutex, 1 );
 			portEXIT_CRITICAL();
 			return pdTRUE;
 			}
 		else
 			{
+			traceADDON( addontraceMUTEX_TIMEOUT, pxMutex, 0 );
 			portEXIT_CRITICAL();
 			return pdFALSE;
 			}
@@ -63,6 +70,7 @@ signed portBASE_TYPE xMutexTake( xMutexHandle pxMutex, portTickType xTicksToWait
 		{
 		pxMutex->pxOwner = xTaskGetCurrentTaskHandle();
 		pxMutex->uxCount = 1;
+		traceADDON( addontraceMUTEX_TAKE, pxMutex, 1 );
 		portEXIT_CRITICAL();
 		return pdTRUE;
 		}
@@ -86,16 +94,19 @@ signed portBASE_TYPE xMutexGive( xMutexHandle pxMutex, portBASE_TYPE Release )
 		{
 		if( --pxMutex->uxCount != 0 )
 			{
+			traceADDON( addontraceMUTEX_GIVE, pxMutex, pxMutex->uxCount );
 			portEXIT_CRITICAL();
 			return pdFALSE;
 			}
 		}
 	
+	traceADDON( addontraceMUTEX_GIVE, pxMutex, 0 );
 
 	if( !listLIST_IS_EMPTY( &pxMutex->xTasksWaitingToTake ))
 		{
 		pxMutex->pxOwner = (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( (&pxMutex->xTasksWaitingToTake) );
 		pxMutex->uxCount = 1;
+		traceADDON_TASK( addontraceMUTEX_HANDOFF, pxMutex, pxMutex->pxOwner, 0 );
 
 		if( xTaskRemoveFromEventList( &pxMutex->xTasksWaitingToTake ) == pdTRUE )
 			taskYIELD();
@@ -118,3 +129,5 @@ signed portBASE_TYPE xDoIOwnTheMutex( xMutexHandle pxMutex )
 	return c;
 	}
 //==============================================================================
+#endif	//	!defined MUTEX_SMP
+//==============================================================================
@@ -8,12 +8,26 @@
 //==============================================================================
 #include "FreeRTOS.h"
 //==============================================================================
+#if			defined __cplusplus
+extern "C" {
+#endif	//	defined __cplusplus
+
 typedef void			*xMutexHandle;
 
 xMutexHandle			xMutexCreate( void );
 signed portBASE_TYPE	xMutexTake( xMutexHandle pxMutex, portTickType xTicksToWait );
 signed portBASE_TYPE	xMutexGive( xMutexHandle pxMutex, portBASE_TYPE Release );
 signed portBASE_TYPE	xDoIOwnTheMutex( xMutexHandle pxMutex );
+
+#if			defined MUTEX_SMP
+// Adaptive spinning before blocking, see mutex_smp.c. The limit is in microseconds, zero disables it.
+void					vMutexSetSpinLimit( xMutexHandle pxMutex, size_t uxSpinLimit );
+void					vMutexGetSpinStats( xMutexHandle pxMutex, size_t *puxAttempts, size_t *puxSuccesses );
+#endif	//	defined MUTEX_SMP
+
+#if			defined __cplusplus
+}
+#endif	//	defined __cplusplus
 //==============================================================================
 #endif	//	__MUTEX_H__
 //==============================================================================
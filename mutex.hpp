@@ -0,0 +1,83 @@
+//==============================================================================
+// Copyright (c) 2007-2009, Isaac Marino Bavaresco
+// All rights reserved
+// isaacbavaresco@yahoo.com.br
+//==============================================================================
+// C++ guard for mutex.h, header only.
+//
+// A MutexLock takes the mutex when constructed and gives it back (one level of
+// nesting) when destroyed. It can be moved, to return it from a function for
+// instance, but not copied, and it must not leave the task that took the mutex:
+// only the owner can give it.
+//==============================================================================
+#ifndef		__MUTEX_HPP__
+#define		__MUTEX_HPP__
+//==============================================================================
+#include "mutex.h"
+//==============================================================================
+namespace addons
+{
+//==============================================================================
+class MutexLock
+	{
+	public:
+		MutexLock() noexcept : pxMutex( nullptr ) {}
+
+		// Check OwnsLock() when xTicksToWait is not portMAX_DELAY.
+		explicit MutexLock( xMutexHandle pxMutex, portTickType xTicksToWait = portMAX_DELAY ) noexcept
+			: pxMutex( xMutexTake( pxMutex, xTicksToWait ) == pdTRUE ? pxMutex : nullptr )
+			{}
+
+		MutexLock( MutexLock &&Other ) noexcept : pxMutex( Other.pxMutex )
+			{
+			Other.pxMutex	= nullptr;
+			}
+
+		MutexLock &operator=( MutexLock &&Other ) noexcept
+			{
+			if( this != &Other )
+				{
+				Unlock();
+				pxMutex			= Other.pxMutex;
+				Other.pxMutex	= nullptr;
+				}
+			return *this;
+			}
+
+		MutexLock( const MutexLock & )				= delete;
+		MutexLock &operator=( const MutexLock & )	= delete;
+
+		~MutexLock()
+			{
+			Unlock();
+			}
+
+		bool			OwnsLock() const		{ return pxMutex != nullptr; }
+		explicit		operator bool() const	{ return pxMutex != nullptr; }
+
+		void Unlock() noexcept
+			{
+			if( pxMutex != nullptr )
+				{
+				xMutexGive( pxMutex, pdFALSE );
+				pxMutex	= nullptr;
+				}
+			}
+
+		// Stops guarding the mutex without giving it.
+		xMutexHandle Release() noexcept
+			{
+			xMutexHandle	pxReleased	= pxMutex;
+
+			pxMutex	= nullptr;
+			return pxReleased;
+			}
+
+	private:
+		xMutexHandle	pxMutex;
+	};
+//==============================================================================
+}	// namespace addons
+//==============================================================================
+#endif	//	__MUTEX_HPP__
+//==============================================================================
@@ -0,0 +1,397 @@
+//==============================================================================
+// Copyright (c) 2007-2009, Isaac Marino Bavaresco
+// All rights reserved
+// isaacbavaresco@yahoo.com.br
+//==============================================================================
+// SMP build of the mutex, selected by defining MUTEX_SMP (mutex.c then
+// compiles to nothing).
+//
+// Owner and count are protected by a per-mutex spinlock, so taking and giving
+// an uncontended mutex never touches the kernel lock. Only when a task has to
+// block, or a give has to hand the mutex over to a blocked task, the kernel
+// critical section is entered (always before the spinlock).
+//
+// Before blocking, a task may also spin for a while if the owner is running on
+// another core, since the owner will probably give the mutex sooner than two
+// context switches would take. The spin is bounded in time, by a budget that
+// adapts to the observed hold times, and never longer than the mutex's limit,
+// which can be set (or disabled) per mutex with vMutexSetSpinLimit.
+//
+// Spinning needs a fast free-running 32-bit counter, such as the Cortex-M
+// DWT cycle counter, given in FreeRTOSConfig.h as mutexSPIN_CLOCK() and its
+// frequency mutexSPIN_CLOCK_HZ. Without them the mutex never spins.
+//
+// Whether the owner is still running is told by the context switches of its
+// core: the owner notes its core and that core's switch count when it takes
+// the mutex, and the count moves on as soon as the owner is switched out. For
+// that, FreeRTOSConfig.h must count the switches and say it does:
+//
+//	extern volatile unsigned long ulMutexSwitchCounts[];
+//	#define traceTASK_SWITCHED_OUT()	ulMutexSwitchCounts[ portGET_CORE_ID() ]++
+//	#define mutexTRACK_SWITCHES			1
+//
+// Without mutexTRACK_SWITCHES a blocked or preempted owner would look running,
+// so the mutex doesn't spin at all and a contended take blocks at once.
+//==============================================================================
+#include "FreeRTOS.h"
+#include "list.h"
+#include "task.h"
+#include "spinlock.h"
+#include "addontrace.h"
+//==============================================================================
+#if			defined MUTEX_SMP
+//==============================================================================
+// Longest spin, in microseconds.
+#if			!defined mutexDEFAULT_SPIN_LIMIT
+#define	mutexDEFAULT_SPIN_LIMIT		20
+#endif	//	!defined mutexDEFAULT_SPIN_LIMIT
+
+#if			defined mutexSPIN_CLOCK && defined mutexSPIN_CLOCK_HZ && defined mutexTRACK_SWITCHES && mutexTRACK_SWITCHES
+#define	mutexSPIN_ENABLED			1
+#else
+#define	mutexSPIN_ENABLED			0
+#if			defined mutexSPIN_CLOCK
+#warning "mutexSPIN_CLOCK is defined but mutexTRACK_SWITCHES is not, the mutex won't spin"
+#endif
+#endif
+
+// Tells the core we are spinning, so it can save power or yield to its sibling thread.
+#if			!defined mutexSPIN_PAUSE
+#if			defined __arm__ || defined __aarch64__
+#define	mutexSPIN_PAUSE()			__asm volatile( "yield" )
+#elif		defined __i386__ || defined __x86_64__
+#define	mutexSPIN_PAUSE()			__builtin_ia32_pause()
+#else
+#define	mutexSPIN_PAUSE()
+#endif
+#endif	//	!defined mutexSPIN_PAUSE
+
+#if			defined configNUMBER_OF_CORES && configNUMBER_OF_CORES > 1
+#define	mutexNUM_CORES				configNUMBER_OF_CORES
+#define	mutexCORE_ID()				portGET_CORE_ID()
+#else
+#define	mutexNUM_CORES				1
+#define	mutexCORE_ID()				0
+#endif
+
+// uxOwnerCore of an owner that has been handed the mutex but is not running yet.
+#define	mutexNO_CORE				( (unsigned portBASE_TYPE)-1 )
+//==============================================================================
+// Context switches per core, counted by traceTASK_SWITCHED_OUT (see above).
+volatile unsigned long	ulMutexSwitchCounts[ mutexNUM_CORES ];
+//==============================================================================
+typedef struct
+{
+	xList			xTasksWaitingToTake;
+	xTaskHandle		pxOwner;
+	size_t			uxCount;
+	xSpinLock		xLock;
+	size_t			uxWaiting;	// Hint only, may count tasks that already timed out
+	unsigned portBASE_TYPE	uxOwnerCore;	// Core the owner took the mutex on
+	unsigned long	ulOwnerSwitches;	// That core's switch count at the time
+	uint32_t		ulSpinLimit;	// In mutexSPIN_CLOCK ticks, zero disables spinning
+	uint32_t		ulSpinEstimate;	// Running average of the time that was needed
+	size_t			uxSpinAttempts;
+	size_t			uxSpinSuccesses;
+} xMUTEX;
+//==============================================================================
+typedef xMUTEX *xMutexHandle;
+//==============================================================================
+// Converts a spin limit from microseconds to mutexSPIN_CLOCK ticks.
+//==============================================================================
+static uint32_t prvSpinTicks( size_t uxMicroseconds )
+	{
+#if			mutexSPIN_ENABLED
+	return (uint32_t)( (unsigned long long)uxMicroseconds * mutexSPIN_CLOCK_HZ / 1000000 );
+#else	//	mutexSPIN_ENABLED
+	( void )uxMicroseconds;
+	return 0;
+#endif	//	mutexSPIN_ENABLED
+	}
+//==============================================================================
+xMutexHandle xMutexCreate( void )
+{
+xMUTEX *pxNewMutex;
+
+	pxNewMutex = pvPortMalloc( sizeof( xMUTEX ));
+	if( pxNewMutex != NULL )
+	{
+		pxNewMutex->pxOwner		= NULL;
+		pxNewMutex->uxCount		= 0;
+		pxNewMutex->xLock		= spinlockINIT;
+		pxNewMutex->uxWaiting	= 0;
+		pxNewMutex->uxOwnerCore		= mutexNO_CORE;
+		pxNewMutex->ulOwnerSwitches	= 0;
+		pxNewMutex->ulSpinLimit		= prvSpinTicks( mutexDEFAULT_SPIN_LIMIT );
+		pxNewMutex->ulSpinEstimate	= 0;
+		pxNewMutex->uxSpinAttempts	= 0;
+		pxNewMutex->uxSpinSuccesses	= 0;
+		vListInitialise( &( pxNewMutex->xTasksWaitingToTake ) );
+	}
+
+	return pxNewMutex;
+}
+//==============================================================================
+// Makes the current task the owner and notes where it runs. Must be called with
+// the mutex's lock held, which also keeps us on this core.
+//==============================================================================
+static inline __attribute((always_inline)) void prvSetOwner( xMUTEX *pxMutex, xTaskHandle pxCurrent )
+	{
+	unsigned portBASE_TYPE	uxCore = mutexCORE_ID();
+
+	pxMutex->pxOwner			= pxCurrent;
+	pxMutex->uxCount			= 1;
+	pxMutex->uxOwnerCore		= uxCore;
+	pxMutex->ulOwnerSwitches	= ulMutexSwitchCounts[ uxCore ];
+	}
+//==============================================================================
+#if			mutexSPIN_ENABLED
+//==============================================================================
+// The owner hasn't been switched out since it took the mutex. Read without the
+// lock, a torn read only makes one check wrong.
+//==============================================================================
+static inline __attribute((always_inline)) portBASE_TYPE prvOwnerIsRunning( xMUTEX *pxMutex )
+	{
+	unsigned portBASE_TYPE	uxCore = __atomic_load_n( &pxMutex->uxOwnerCore, __ATOMIC_RELAXED );
+
+	return uxCore < mutexNUM_CORES
+		&& __atomic_load_n( &ulMutexSwitchCounts[ uxCore ], __ATOMIC_RELAXED ) == __atomic_load_n( &pxMutex->ulOwnerSwitches, __ATOMIC_RELAXED );
+	}
+//==============================================================================
+// Spins while the owner is running on another core, for twice the time that
+// recently sufficed plus an eighth of the limit, and never beyond the limit.
+// Returns pdTRUE if the mutex was taken.
+//
+// A spin that took the mutex moves the estimate a quarter of the way to the
+// time it took. One that ran out its budget with the owner still running
+// shows the budget was too short, so the estimate grows to it (and the next
+// budget doubles). When the owner stops running, the spin is cut short without
+// telling anything about the hold time.
+//==============================================================================
+static portBASE_TYPE prvSpinForMutex( xMUTEX *pxMutex, xTaskHandle pxCurrent )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	uint32_t				ulStart, ulElapsed, ulBudget;
+	portBASE_TYPE			xTaken = pdFALSE, xOwnerStopped = pdFALSE;
+
+	ulBudget	= pxMutex->ulSpinEstimate * 2 + pxMutex->ulSpinLimit / 8;
+	if( ulBudget > pxMutex->ulSpinLimit )
+		ulBudget	= pxMutex->ulSpinLimit;
+
+	ulStart		= mutexSPIN_CLOCK();
+	for( ;; )
+		{
+		if( __atomic_load_n( &pxMutex->pxOwner, __ATOMIC_RELAXED ) == NULL )
+			{
+			uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+			if( pxMutex->pxOwner == NULL )
+				{
+				prvSetOwner( pxMutex, pxCurrent );
+				xTaken	= pdTRUE;
+				}
+			vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+			}
+
+		ulElapsed	= mutexSPIN_CLOCK() - ulStart;
+		if( xTaken )
+			break;
+		// A preempted or blocked owner won't give the mutex soon, stop wasting the core.
+		if( !prvOwnerIsRunning( pxMutex ))
+			{
+			xOwnerStopped	= pdTRUE;
+			break;
+			}
+		if( ulElapsed >= ulBudget )
+			break;
+
+		mutexSPIN_PAUSE();
+		}
+
+	uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+	pxMutex->uxSpinAttempts++;
+	if( xTaken )
+		{
+		pxMutex->uxSpinSuccesses++;
+		pxMutex->ulSpinEstimate	= (uint32_t)( (long)pxMutex->ulSpinEstimate + ( (long)ulElapsed - (long)pxMutex->ulSpinEstimate ) / 4 );
+		}
+	else if( !xOwnerStopped && ulBudget > pxMutex->ulSpinEstimate )
+		pxMutex->ulSpinEstimate	= ulBudget;
+	vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+
+	traceADDON( addontraceMUTEX_SPIN, pxMutex, ( ulElapsed & 0x7fffff ) | ( xTaken ? 0x800000 : 0 ));
+
+	return xTaken;
+	}
+//==============================================================================
+#endif	//	mutexSPIN_ENABLED
+//==============================================================================
+signed portBASE_TYPE xMutexTake( xMutexHandle pxMutex, portTickType xTicksToWait )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	xTaskHandle				pxCurrent;
+	portBASE_TYPE			xMustWait;
+
+	pxCurrent	= xTaskGetCurrentTaskHandle();
+
+	uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+	if( pxMutex->pxOwner == pxCurrent )
+		{
+		pxMutex->uxCount++;
+		vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+		traceADDON( addontraceMUTEX_TAKE, pxMutex, pxMutex->uxCount );
+		return pdTRUE;
+		}
+
+	if( pxMutex->pxOwner == NULL )
+		{
+		prvSetOwner( pxMutex, pxCurrent );
+		vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+		traceADDON( addontraceMUTEX_TAKE, pxMutex, 1 );
+		return pdTRUE;
+		}
+	vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+
+	if( xTicksToWait == ( portTickType ) 0 )
+		return pdFALSE;
+
+	traceADDON( addontraceMUTEX_CONTEND, pxMutex, xTicksToWait );
+
+#if			mutexSPIN_ENABLED
+	if( pxMutex->ulSpinLimit != 0 && prvSpinForMutex( pxMutex, pxCurrent ))
+		{
+		traceADDON( addontraceMUTEX_TAKE, pxMutex, 1 );
+		return pdTRUE;
+		}
+#endif	//	mutexSPIN_ENABLED
+
+	taskENTER_CRITICAL();
+
+	// The owner may have given the mutex while we were getting the kernel lock.
+	uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+	if(( xMustWait = pxMutex->pxOwner != NULL ) != pdFALSE )
+		pxMutex->uxWaiting++;
+	else
+		prvSetOwner( pxMutex, pxCurrent );
+	vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+
+	if( !xMustWait )
+		{
+		taskEXIT_CRITICAL();
+		traceADDON( addontraceMUTEX_TAKE, pxMutex, 1 );
+		return pdTRUE;
+		}
+
+	vTaskPlaceOnEventList( &( pxMutex->xTasksWaitingToTake ), xTicksToWait );
+	taskEXIT_CRITICAL();
+	taskYIELD();
+
+	// xMutexGive hands the mutex over directly, we only have to check it.
+	uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+	pxMutex->uxWaiting--;
+	if(( xMustWait = pxMutex->pxOwner != pxCurrent ) == pdFALSE )
+		{
+		// Now we are running, spinners may wait for us.
+		pxMutex->uxOwnerCore		= mutexCORE_ID();
+		pxMutex->ulOwnerSwitches	= ulMutexSwitchCounts[ pxMutex->uxOwnerCore ];
+		}
+	vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+
+	traceADDON( xMustWait ? addontraceMUTEX_TIMEOUT : addontraceMUTEX_TAKE, pxMutex, xMustWait ? 0 : 1 );
+
+	return xMustWait ? pdFALSE : pdTRUE;
+	}
+//==============================================================================
+signed portBASE_TYPE xMutexGive( xMutexHandle pxMutex, portBASE_TYPE Release )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	portBASE_TYPE			xMustYield = pdFALSE;
+	xTaskHandle				pxNewOwner;
+
+	uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+	if( pxMutex->pxOwner != xTaskGetCurrentTaskHandle() )
+		{
+		vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+		return pdFALSE;
+		}
+
+	if( Release )
+		pxMutex->uxCount = 0;
+	else
+		{
+		if( --pxMutex->uxCount != 0 )
+			{
+			vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+			traceADDON( addontraceMUTEX_GIVE, pxMutex, pxMutex->uxCount );
+			return pdFALSE;
+			}
+		}
+
+	if( pxMutex->uxWaiting == 0 )
+		{
+		pxMutex->pxOwner = NULL;
+		vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+		traceADDON( addontraceMUTEX_GIVE, pxMutex, 0 );
+		return pdTRUE;
+		}
+	vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+	traceADDON( addontraceMUTEX_GIVE, pxMutex, 0 );
+
+	// We are still the owner, so no new task can take the mutex meanwhile.
+	taskENTER_CRITICAL();
+
+	uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+	if( !listLIST_IS_EMPTY( &pxMutex->xTasksWaitingToTake ))
+		{
+		pxNewOwner = (xTaskHandle)listGET_OWNER_OF_HEAD_ENTRY( (&pxMutex->xTasksWaitingToTake) );
+		pxMutex->pxOwner = pxNewOwner;
+		pxMutex->uxCount = 1;
+		pxMutex->uxOwnerCore = mutexNO_CORE;
+		vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+		traceADDON_TASK( addontraceMUTEX_HANDOFF, pxMutex, pxNewOwner, 0 );
+
+		// Also interrupts the other core if the new owner must preempt its task.
+		xMustYield = xTaskRemoveFromEventList( &pxMutex->xTasksWaitingToTake );
+		}
+	else
+		{
+		pxMutex->pxOwner = NULL;
+		vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+		}
+
+	taskEXIT_CRITICAL();
+
+	if( xMustYield == pdTRUE )
+		taskYIELD();
+
+	return pdTRUE;
+	}
+//==============================================================================
+signed portBASE_TYPE xDoIOwnTheMutex( xMutexHandle pxMutex )
+	{
+	// Only we can make the mutex ours or stop it being ours.
+	return __atomic_load_n( &pxMutex->pxOwner, __ATOMIC_RELAXED ) == xTaskGetCurrentTaskHandle();
+	}
+//==============================================================================
+void vMutexSetSpinLimit( xMutexHandle pxMutex, size_t uxSpinLimit )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+	uint32_t				ulTicks = prvSpinTicks( uxSpinLimit );
+
+	uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+	pxMutex->ulSpinLimit	= ulTicks;
+	pxMutex->ulSpinEstimate	= 0;
+	vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+	}
+//==============================================================================
+void vMutexGetSpinStats( xMutexHandle pxMutex, size_t *puxAttempts, size_t *puxSuccesses )
+	{
+	unsigned portBASE_TYPE	uxSavedMask;
+
+	uxSavedMask	= uxSpinLockAcquire( &pxMutex->xLock );
+	*puxAttempts	= pxMutex->uxSpinAttempts;
+	*puxSuccesses	= pxMutex->uxSpinSuccesses;
+	vSpinLockRelease( &pxMutex->xLock, uxSavedMask );
+	}
+//==============================================================================
+#endif	//	defined MUTEX_SMP
+//==============================================================================
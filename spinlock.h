@@ -0,0 +1,41 @@
+//==============================================================================
+// Copyright (c) 2007-2009, Isaac Marino Bavaresco
+// All rights reserved
+// isaacbavaresco@yahoo.com.br
+//==============================================================================
+// Per-object spinlocks for the SMP builds of flexiqueue and mutex.
+//
+// The lock also masks interrupts on the local core, so an ISR can never spin
+// on a lock held by the task it interrupted. It must be held only for a few
+// instructions and never across a call into the kernel; when both are needed
+// the kernel critical section is entered first.
+//==============================================================================
+#ifndef		__SPINLOCK_H__
+#define		__SPINLOCK_H__
+//==============================================================================
+#include "FreeRTOS.h"
+//==============================================================================
+typedef volatile unsigned portBASE_TYPE	xSpinLock;
+
+#define	spinlockINIT					0
+//==============================================================================
+static inline __attribute((always_inline)) unsigned portBASE_TYPE uxSpinLockAcquire( xSpinLock *pxLock )
+	{
+	unsigned portBASE_TYPE uxSavedMask;
+
+	uxSavedMask = portSET_INTERRUPT_MASK_FROM_ISR();
+	while( __atomic_exchange_n( pxLock, 1, __ATOMIC_ACQUIRE ) != 0 )
+		while( __atomic_load_n( pxLock, __ATOMIC_RELAXED ) != 0 )
+			{}
+
+	return uxSavedMask;
+	}
+//==============================================================================
+static inline __attribute((always_inline)) void vSpinLockRelease( xSpinLock *pxLock, unsigned portBASE_TYPE uxSavedMask )
+	{
+	__atomic_store_n( pxLock, 0, __ATOMIC_RELEASE );
+	portCLEAR_INTERRUPT_MASK_FROM_ISR( uxSavedMask );
+	}
+//==============================================================================
+#endif	//	__SPINLOCK_H__
+//==============================================================================